@@ -14,6 +14,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <string.h>
 
 #ifdef TARGET_LIKE_MBED
 	#include "core.h"
@@ -23,8 +24,38 @@
 
 #include "decoder.h"
 
+//Load 8 bytes as a big endian word, as the stream is written MSB first
+RAVENS_CRITICAL static inline uint64_t loadWindow(const uint8_t * bytes)
+{
+	uint64_t window;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	memcpy(&window, bytes, sizeof(window));
+#elif defined(__BYTE_ORDER__) && defined(__GNUC__)
+	memcpy(&window, bytes, sizeof(window));
+	window = __builtin_bswap64(window);
+#else
+	window = 0;
+	for(uint8_t i = 0; i < sizeof(window); ++i)
+		window = (window << 8u) | bytes[i];
+#endif
+
+	return window;
+}
+
 RAVENS_CRITICAL uint64_t readBits(const uint8_t * bitField, size_t * currentOffset, size_t length, uint8_t lengthToRead)
 {
+	//Fast path: the field fits in a 64 bits window starting at the current byte, which we extract with a single shift
+	//	Only the end of the stream, or fields wider than 56 bits, go through the byte by byte loop
+	const size_t byteOffset = *currentOffset >> 3u;
+	if(lengthToRead != 0 && lengthToRead <= 56 && byteOffset + sizeof(uint64_t) <= length)
+	{
+		const uint64_t window = loadWindow(&bitField[byteOffset]) << (*currentOffset & 7u);
+
+		*currentOffset += lengthToRead;
+		return window >> (64u - lengthToRead);
+	}
+
 	uint64_t output = 0;
 
 	while (lengthToRead)
@@ -61,9 +92,146 @@ RAVENS_CRITICAL uint64_t readBits(const uint8_t * bitField, size_t * currentOffs
 	return output;
 }
 
-RAVENS_CRITICAL size_t readBlockID(DecoderContext * context, const uint8_t * byteStream, size_t * currentByteOffset, size_t length)
+RAVENS_CRITICAL void initEntropyModels(EntropyModels * models)
+{
+	uint16_t * probabilities = &models->opcode[0][0];
+	for(size_t i = 0; i < sizeof(models->opcode) / sizeof(uint16_t); ++i)
+		probabilities[i] = 1u << (ENTROPY_PROBABILITY_BITS - 1u);
+
+	probabilities = &models->width[0][0];
+	for(size_t i = 0; i < sizeof(models->width) / sizeof(uint16_t); ++i)
+		probabilities[i] = 1u << (ENTROPY_PROBABILITY_BITS - 1u);
+
+	models->previousOpcode = 0;
+	models->previousBlockID = 0;
+}
+
+RAVENS_CRITICAL static uint8_t nextEntropyByte(EntropyDecoder * decoder)
+{
+	//The encoder flushes enough bytes for the decoder to never need more. Reading past them is a corrupted stream, decoded as zeros
+	if(decoder->position >= decoder->end)
+		return 0;
+
+	return decoder->byteStream[decoder->position++];
+}
+
+RAVENS_CRITICAL bool initEntropyDecoder(EntropyDecoder * decoder, const uint8_t * byteStream, size_t length)
 {
-	const size_t baseBlockID = readBits(byteStream, currentByteOffset, length, context->blockIDBits);
+	if(length < ENTROPY_HEADER_LENGTH)
+		return false;
+
+	const uint32_t codedLength = (uint32_t) byteStream[0] | ((uint32_t) byteStream[1] << 8u) | ((uint32_t) byteStream[2] << 16u) | ((uint32_t) byteStream[3] << 24u);
+	if(codedLength > length - ENTROPY_HEADER_LENGTH)
+		return false;
+
+	initEntropyModels(&decoder->models);
+
+	decoder->byteStream = byteStream;
+	decoder->position = ENTROPY_HEADER_LENGTH;
+	decoder->end = ENTROPY_HEADER_LENGTH + codedLength;
+
+	decoder->range = UINT32_MAX;
+	decoder->code = 0;
+	for(uint8_t i = 0; i < 5; ++i)
+		decoder->code = (decoder->code << 8u) | nextEntropyByte(decoder);
+
+	return true;
+}
+
+RAVENS_CRITICAL static void normalizeEntropyDecoder(EntropyDecoder * decoder)
+{
+	while(decoder->range < ENTROPY_TOP_VALUE)
+	{
+		decoder->range <<= 8u;
+		decoder->code = (decoder->code << 8u) | nextEntropyByte(decoder);
+	}
+}
+
+RAVENS_CRITICAL static uint8_t decodeEntropyBit(EntropyDecoder * decoder, uint16_t * probability)
+{
+	const uint32_t bound = (decoder->range >> ENTROPY_PROBABILITY_BITS) * *probability;
+	uint8_t bit;
+
+	if(decoder->code < bound)
+	{
+		decoder->range = bound;
+		*probability += ((1u << ENTROPY_PROBABILITY_BITS) - *probability) >> ENTROPY_ADAPTATION_SHIFT;
+		bit = 0;
+	}
+	else
+	{
+		decoder->range -= bound;
+		decoder->code -= bound;
+		*probability -= *probability >> ENTROPY_ADAPTATION_SHIFT;
+		bit = 1;
+	}
+
+	normalizeEntropyDecoder(decoder);
+	return bit;
+}
+
+RAVENS_CRITICAL static uint8_t decodeDirectBit(EntropyDecoder * decoder)
+{
+	uint8_t bit = 0;
+
+	decoder->range >>= 1u;
+	if(decoder->code >= decoder->range)
+	{
+		decoder->code -= decoder->range;
+		bit = 1;
+	}
+
+	normalizeEntropyDecoder(decoder);
+	return bit;
+}
+
+RAVENS_CRITICAL static uint32_t decodeEntropyTree(EntropyDecoder * decoder, uint16_t * probabilities, uint8_t bits)
+{
+	uint32_t index = 1;
+
+	for(uint8_t i = 0; i < bits; ++i)
+		index = (index << 1u) | decodeEntropyBit(decoder, &probabilities[index]);
+
+	return index - (1u << bits);
+}
+
+RAVENS_CRITICAL static uint32_t decodeEntropyField(EntropyDecoder * decoder, FieldKind kind)
+{
+	EntropyModels * models = &decoder->models;
+
+	if(kind == FIELD_OPCODE)
+	{
+		models->previousOpcode = (uint8_t) decodeEntropyTree(decoder, models->opcode[models->previousOpcode >> 2u], INSTRUCTION_WIDTH);
+		return models->previousOpcode;
+	}
+
+	const uint32_t width = decodeEntropyTree(decoder, models->width[kind], ENTROPY_WIDTH_BITS);
+	uint32_t value = width != 0;
+
+	for(uint32_t i = 1; i < width; ++i)
+		value = (value << 1u) | decodeDirectBit(decoder);
+
+	if(kind == FIELD_BLOCK_ID)
+	{
+		//Undo the zigzag encoding of the difference
+		models->previousBlockID += (value >> 1u) ^ (0u - (value & 1u));
+		value = models->previousBlockID;
+	}
+
+	return value;
+}
+
+RAVENS_CRITICAL static uint64_t readField(DecoderContext * context, const uint8_t * byteStream, size_t * currentByteOffset, size_t length, uint8_t width, FieldKind kind)
+{
+	if(context->entropy != NULL)
+		return decodeEntropyField(context->entropy, kind);
+
+	return readBits(byteStream, currentByteOffset, length, width);
+}
+
+RAVENS_CRITICAL size_t readBlockID(DecoderContext * context, const uint8_t * byteStream, size_t * currentByteOffset, size_t length, FieldKind kind)
+{
+	const size_t baseBlockID = readField(context, byteStream, currentByteOffset, length, context->blockIDBits, kind);
 
 	return context->blockBase + ((baseBlockID & MASK_OF_WIDTH(context->blockIDBits)) << context->blockSizeBitsRef);
 }
@@ -72,7 +240,7 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 {
 	command->mainAddress = command->secondaryAddress = command->length = 0;
 
-	uint64_t instruction = readBits(byteStream, currentByteOffset, length, INSTRUCTION_WIDTH);
+	uint64_t instruction = readField(context, byteStream, currentByteOffset, length, INSTRUCTION_WIDTH, FIELD_OPCODE);
 	command->command = (OPCODE) instruction;
 
 	switch (instruction)
@@ -85,7 +253,7 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 			if (context->usingBlock)
 				command->mainAddress = context->blockInUse;
 			else
-				command->mainAddress = readBlockID(context, byteStream, currentByteOffset, length);
+				command->mainAddress = readBlockID(context, byteStream, currentByteOffset, length, FIELD_BLOCK_ID);
 
 			break;
 		}
@@ -95,15 +263,15 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 			if (context->usingBlock)
 				command->mainAddress = context->blockInUse;
 			else
-				command->mainAddress = readBlockID(context, byteStream, currentByteOffset, length);
+				command->mainAddress = readBlockID(context, byteStream, currentByteOffset, length, FIELD_BLOCK_ID);
 
-			command->length = readBits(byteStream, currentByteOffset, length, context->blockSizeBitsRef) + 1;
+			command->length = readField(context, byteStream, currentByteOffset, length, context->blockSizeBitsRef, FIELD_LENGTH) + 1;
 			break;
 		}
 
 		case OPCODE_USE_BLOCK:
 		{
-			context->blockInUse = readBlockID(context, byteStream, currentByteOffset, length);
+			context->blockInUse = readBlockID(context, byteStream, currentByteOffset, length, FIELD_BLOCK_ID);
 			context->usingBlock = true;
 
 			command->mainAddress = context->blockInUse;
@@ -114,6 +282,11 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 		case OPCODE_END_OF_STREAM:
 		{
 			context->usingBlock = false;
+
+			//The section following the commands starts after the last byte of the coded stream
+			if(instruction == OPCODE_END_OF_STREAM && context->entropy != NULL)
+				*currentByteOffset = context->entropy->end << 3u;
+
 			break;
 		}
 
@@ -134,11 +307,11 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 				if (context->usingBlock)
 					command->mainAddress = context->blockInUse;
 				else
-					command->mainAddress = readBlockID(context, byteStream, currentByteOffset, length);
+					command->mainAddress = readBlockID(context, byteStream, currentByteOffset, length, FIELD_BLOCK_ID);
 			}
 
-			command->mainAddress |= readBits(byteStream, currentByteOffset, length, context->blockSizeBitsRef);
-			command->length = readBits(byteStream, currentByteOffset, length, context->blockSizeBitsRef) + 1;
+			command->mainAddress |= readField(context, byteStream, currentByteOffset, length, context->blockSizeBitsRef, FIELD_OFFSET);
+			command->length = readField(context, byteStream, currentByteOffset, length, context->blockSizeBitsRef, FIELD_LENGTH) + 1;
 
 			if (isSecCache)
 			{
@@ -149,10 +322,10 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 				if (context->usingBlock && isMainCache)
 					command->secondaryAddress = context->blockInUse;
 				else
-					command->secondaryAddress = readBlockID(context, byteStream, currentByteOffset, length);
+					command->secondaryAddress = readBlockID(context, byteStream, currentByteOffset, length, FIELD_BLOCK_ID);
 			}
 
-			command->secondaryAddress |= readBits(byteStream, currentByteOffset, length, context->blockSizeBitsRef);
+			command->secondaryAddress |= readField(context, byteStream, currentByteOffset, length, context->blockSizeBitsRef, FIELD_OFFSET);
 			break;
 		}
 
@@ -166,17 +339,17 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 				if (context->usingBlock)
 					command->mainAddress = context->blockInUse;
 				else
-					command->mainAddress = readBlockID(context, byteStream, currentByteOffset, length);
+					command->mainAddress = readBlockID(context, byteStream, currentByteOffset, length, FIELD_BLOCK_ID);
 			}
 
-			command->mainAddress |= readBits(byteStream, currentByteOffset, length, context->blockSizeBitsRef);
-			command->length = readBits(byteStream, currentByteOffset, length, context->blockSizeBitsRef) + 1;
+			command->mainAddress |= readField(context, byteStream, currentByteOffset, length, context->blockSizeBitsRef, FIELD_OFFSET);
+			command->length = readField(context, byteStream, currentByteOffset, length, context->blockSizeBitsRef, FIELD_LENGTH) + 1;
 			break;
 		}
 
 		case OPCODE_CHAINED_SKIP:
 		{
-			command->length = readBits(byteStream, currentByteOffset, length, MAX_SKIP_LENGTH_BITS) + 1;
+			command->length = readField(context, byteStream, currentByteOffset, length, MAX_SKIP_LENGTH_BITS, FIELD_SKIP) + 1;
 			break;
 		}
 
@@ -185,8 +358,8 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 			context->blockIDBits = context->blockIDBitsRef;
 			context->blockBase = 0;
 
-			context->blockBase = readBlockID(context, byteStream, currentByteOffset, length);
-			context->blockIDBits = (uint8_t) (readBits(byteStream, currentByteOffset, length, REBASE_LENGTH_BITS) + 1u);
+			context->blockBase = readBlockID(context, byteStream, currentByteOffset, length, FIELD_REBASE);
+			context->blockIDBits = (uint8_t) (readField(context, byteStream, currentByteOffset, length, REBASE_LENGTH_BITS, FIELD_REBASE) + 1u);
 
 			command->mainAddress = context->blockBase;
 			command->length = (1u << context->blockIDBits) - 1u;
@@ -203,3 +376,71 @@ RAVENS_CRITICAL bool decodeInstruction(DecoderContext * context, const uint8_t *
 
 	return true;
 }
+
+RAVENS_CRITICAL static uint16_t numberOfCheckpoints(const uint8_t * byteStream)
+{
+	uint16_t numberCheckpoints;
+	memcpy(&numberCheckpoints, byteStream, sizeof(numberCheckpoints));
+	return numberCheckpoints;
+}
+
+RAVENS_CRITICAL size_t checkpointTableLength(const uint8_t * byteStream, size_t length)
+{
+	if(length < sizeof(uint16_t))
+		return 0;
+
+	const uint16_t numberCheckpoints = numberOfCheckpoints(byteStream);
+	const size_t tableLength = sizeof(uint16_t) + numberCheckpoints * sizeof(DecoderCheckpoint);
+
+	//The stream must at least have an END_OF_STREAM after the table
+	if(tableLength >= length)
+		return 0;
+
+	//Checkpoints must be sorted, and point to the commands
+	const DecoderCheckpoint * checkpoints = (const DecoderCheckpoint *) &byteStream[sizeof(uint16_t)];
+	for(uint16_t i = 0; i < numberCheckpoints; ++i)
+	{
+		if(checkpoints[i].bitOffset < (tableLength << 3u) || checkpoints[i].bitOffset >= (length << 3u))
+			return 0;
+
+		if(i > 0 && (checkpoints[i].bitOffset <= checkpoints[i - 1].bitOffset || checkpoints[i].traceCounter <= checkpoints[i - 1].traceCounter))
+			return 0;
+	}
+
+	return tableLength;
+}
+
+RAVENS_CRITICAL const DecoderCheckpoint * findCheckpoint(const uint8_t * byteStream, size_t traceCounter)
+{
+	const DecoderCheckpoint * checkpoints = (const DecoderCheckpoint *) &byteStream[sizeof(uint16_t)];
+
+	//Find the first checkpoint at or after the trace counter
+	size_t low = 0, high = numberOfCheckpoints(byteStream);
+	while(low < high)
+	{
+		const size_t middle = (low + high) / 2;
+
+		if(checkpoints[middle].traceCounter < traceCounter)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low == 0 ? NULL : &checkpoints[low - 1];
+}
+
+RAVENS_CRITICAL void saveCheckpoint(const DecoderContext * context, DecoderCheckpoint * checkpoint)
+{
+	checkpoint->usingBlock = context->usingBlock;
+	checkpoint->blockInUse = (uint32_t) context->blockInUse;
+	checkpoint->blockIDBits = context->blockIDBits;
+	checkpoint->blockBase = (uint32_t) context->blockBase;
+}
+
+RAVENS_CRITICAL void restoreCheckpoint(DecoderContext * context, const DecoderCheckpoint * checkpoint)
+{
+	context->usingBlock = checkpoint->usingBlock;
+	context->blockInUse = checkpoint->blockInUse;
+	context->blockIDBits = checkpoint->blockIDBits;
+	context->blockBase = checkpoint->blockBase;
+}
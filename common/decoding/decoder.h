@@ -28,6 +28,62 @@ typedef struct
 	size_t length;
 } DecodedCommand;
 
+/*
+ * Entropy coded format
+ *
+ * The stream starts with the length of the coded commands (32 bits, little endian), followed by the output of a binary range coder (LZMA style).
+ * Instructions have the same fields as in the fixed width format, but each field is coded with adaptive probabilities:
+ *	- opcodes go down a binary tree, in the context of the class (two strongest bits) of the previous opcode,
+ *	- other fields are coded as their width along a binary tree (one per kind of field), then their bits below the strongest one at even odds,
+ *	- BlockIDs are coded as the (zigzag) difference with the previous BlockID.
+ */
+
+#define ENTROPY_PROBABILITY_BITS	11u
+#define ENTROPY_ADAPTATION_SHIFT	5u
+#define ENTROPY_TOP_VALUE			(1u << 24u)
+#define ENTROPY_HEADER_LENGTH		4u
+
+//Fields are at most 31 bits wide, as their width is coded on 5 bits. Zigzag BlockIDs take an extra bit
+#define ENTROPY_WIDTH_BITS			5u
+#define ENTROPY_MAX_FIELD_WIDTH		30u
+
+typedef enum
+{
+	FIELD_OPCODE,
+	FIELD_BLOCK_ID,
+	FIELD_OFFSET,
+	FIELD_LENGTH,
+	FIELD_SKIP,
+	FIELD_REBASE,
+	FIELD_KIND_COUNT
+} FieldKind;
+
+typedef struct
+{
+	uint16_t opcode[4][1u << INSTRUCTION_WIDTH];
+	uint16_t width[FIELD_KIND_COUNT][1u << ENTROPY_WIDTH_BITS];
+
+	uint8_t previousOpcode;
+	uint32_t previousBlockID;
+} EntropyModels;
+
+typedef struct
+{
+	EntropyModels models;
+
+	const uint8_t * byteStream;
+	size_t position;
+	size_t end;
+
+	uint32_t range;
+	uint32_t code;
+} EntropyDecoder;
+
+void initEntropyModels(EntropyModels * models);
+
+//Return false if the coded commands don't fit in the stream
+bool initEntropyDecoder(EntropyDecoder * decoder, const uint8_t * byteStream, size_t length);
+
 typedef struct
 {
 	bool usingBlock;
@@ -40,12 +96,51 @@ typedef struct
 	uint8_t blockIDBitsRef;
 	uint8_t blockSizeBitsRef;
 
+	//Set when decoding the entropy coded format, NULL otherwise
+	EntropyDecoder * entropy;
+
 } DecoderContext;
 
+/*
+ * Checkpointed format
+ *
+ * Fixed width commands, preceded by a table of the state of Munin before some of the erases (the number of checkpoints on 16 bits, then the checkpoints).
+ * When resuming after a power loss, Munin restores the last checkpoint before its trace counter instead of decoding all the commands leading to it.
+ */
+
+typedef struct __attribute__((__packed__))
+{
+	//Offset of the instruction performing the erase, from the beginning of the table
+	uint32_t bitOffset;
+
+	//Trace counter before the erase
+	uint32_t traceCounter;
+
+	//Dynamic part of the DecoderContext
+	uint32_t blockInUse;
+	uint32_t blockBase;
+	uint8_t blockIDBits;
+	bool usingBlock;
+
+	//Address the next chained copy will use
+	uint32_t chainAddress : 31;
+	bool chainIsCache : 1;
+
+} DecoderCheckpoint;
+
 #define MASK_OF_WIDTH(a) ((1u << (a)) - 1u)
 
 bool decodeInstruction(DecoderContext * context, const uint8_t * byteStream, size_t * currentByteOffset, const size_t length, DecodedCommand * command);
 
+//Length of the checkpoint table at the beginning of the stream, or 0 if it is malformed
+size_t checkpointTableLength(const uint8_t * byteStream, size_t length);
+
+//Last checkpoint before the trace counter, NULL if there is none
+const DecoderCheckpoint * findCheckpoint(const uint8_t * byteStream, size_t traceCounter);
+
+void saveCheckpoint(const DecoderContext * context, DecoderCheckpoint * checkpoint);
+void restoreCheckpoint(DecoderContext * context, const DecoderCheckpoint * checkpoint);
+
 #ifdef __cplusplus
 }
 #endif
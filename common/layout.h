@@ -15,7 +15,16 @@
 
 #include "crypto/crypto_utils.h"
 
-#define MANIFEST_FORMAT_VERSION 0
+//Format of the commands in the manifest: fixed width fields, coded with an adaptive range coder, or fixed width preceded by resume checkpoints
+#define MANIFEST_FORMAT_FIXED_WIDTH		0
+#define MANIFEST_FORMAT_ENTROPY_CODED	1
+#define MANIFEST_FORMAT_CHECKPOINTED	2
+
+//Format Munin accepts. May be overridden when building it
+#ifndef MANIFEST_FORMAT_VERSION
+	#define MANIFEST_FORMAT_VERSION MANIFEST_FORMAT_FIXED_WIDTH
+#endif
+
 #define BSDIFF_MAGIC 0x5ec1714e
 
 typedef struct __attribute__((__packed__))
@@ -68,7 +68,7 @@ bool authenticate(vector<VersionData> & versions, const char * inputPath, const
 
 		UpdateHeader manifest1;
 		memset(&manifest1, 0, sizeof(manifest1));
-		manifest1.sectionSignedDeviceKey.formatVersion = MANIFEST_FORMAT_VERSION;
+		manifest1.sectionSignedDeviceKey.formatVersion = _manifestFormat;
 
 		//Get manifest2 size
 		struct stat st;
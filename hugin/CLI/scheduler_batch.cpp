@@ -19,6 +19,7 @@
 #include <rapidjson/error/en.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <dirent.h>
 #include "../Scheduler/bsdiff/bsdiff.h"
 #include "../Scheduler/config.h"
@@ -76,6 +77,61 @@ bool parseConfig(const char * configFile, bool wantManifests, vector<VersionData
 		return false;
 	}
 
+	//Optional timings of the flash, in ms per page erased, µs per byte programmed and µs per byte read
+	if(config.HasMember("flashTiming"))
+	{
+		const auto & timing = config["flashTiming"];
+		if(!timing.IsObject() || !timing.HasMember("eraseMsPerPage") || !timing["eraseMsPerPage"].IsNumber()
+		   || !timing.HasMember("programUsPerByte") || !timing["programUsPerByte"].IsNumber()
+		   || !timing.HasMember("readUsPerByte") || !timing["readUsPerByte"].IsNumber())
+		{
+			cerr << "Invalid config format: invalid flashTiming format" << endl;
+			return false;
+		}
+
+		FlashTimingProfile profile = {timing["eraseMsPerPage"].GetDouble(), timing["programUsPerByte"].GetDouble(), timing["readUsPerByte"].GetDouble()};
+		if(profile.eraseMsPerPage < 0 || profile.programUsPerByte < 0 || profile.readUsPerByte < 0)
+		{
+			cerr << "Invalid config format: flash timings can't be negative" << endl;
+			return false;
+		}
+
+		_flashTimingProfile = profile;
+	}
+
+	//Optional manifest format, which has to match what Munin was built to accept
+	if(config.HasMember("entropyCoding"))
+	{
+		if(!config["entropyCoding"].IsBool())
+		{
+			cerr << "Invalid config format: entropyCoding must be a boolean" << endl;
+			return false;
+		}
+
+		if(config["entropyCoding"].GetBool())
+			_manifestFormat = MANIFEST_FORMAT_ENTROPY_CODED;
+	}
+
+	if(config.HasMember("checkpoints"))
+	{
+		if(!config["checkpoints"].IsBool())
+		{
+			cerr << "Invalid config format: checkpoints must be a boolean" << endl;
+			return false;
+		}
+
+		if(config["checkpoints"].GetBool())
+		{
+			if(_manifestFormat == MANIFEST_FORMAT_ENTROPY_CODED)
+			{
+				cerr << "Invalid config format: checkpoints can't be combined with entropyCoding" << endl;
+				return false;
+			}
+
+			_manifestFormat = MANIFEST_FORMAT_CHECKPOINTED;
+		}
+	}
+
 	if(!config.HasMember("versions") || !config["versions"].IsArray())
 	{
 		cerr << "Invalid config format: versions is missing" << endl;
@@ -286,6 +342,21 @@ bool canUseDir(char * dir)
 	}
 }
 
+//Peak resident memory of the process so far, in KiB
+static long peakMemoryUsage()
+{
+	struct rusage usage = {};
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+#ifdef __APPLE__
+	//macOS reports bytes
+	return usage.ru_maxrss >> 10;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
 bool processSchedulerBatch(const char * configFile, char * outputDir)
 {
 	size_t flashSize, flashPageSize;
@@ -293,9 +364,8 @@ bool processSchedulerBatch(const char * configFile, char * outputDir)
 	if(!parseConfig(configFile, false, versions, flashSize, flashPageSize))
 		return false;
 
-	//Update the value
-	_realBlockSizeBit = flashPageSize;
-	_realFullAddressSpace = flashSize;
+	//The config geometry is used until we're done with this batch
+	FlashGeometryScope geometryScope(FlashGeometry(flashPageSize, flashSize));
 
 	if(versions.size() < 2)
 	{
@@ -349,6 +419,14 @@ bool processSchedulerBatch(const char * configFile, char * outputDir)
 	VersionData finalVersion = versions.back();
 	versions.pop_back();
 
+	//Every patch goes toward the final version, which is thus only mapped once
+	ImageFile finalImage;
+	if(!finalImage.open(finalVersion.binaryPath.c_str()))
+	{
+		cerr << "Couldn't read the final firmware file (" << finalVersion.binaryPath << ")" << endl;
+		return false;
+	}
+
 	for(const auto & oldVersion : versions)
 	{
 		//Craft the output file name
@@ -356,13 +434,22 @@ bool processSchedulerBatch(const char * configFile, char * outputDir)
 		const string fullOutput = string(outputDir) + "/" + output;
 		vector<VerificationRange> preUpdateHashes;
 
+		ImageFile oldImage;
+		if(!oldImage.open(oldVersion.binaryPath.c_str()))
+		{
+			cerr << "Couldn't read version " << to_string(oldVersion.version) << " (file " << oldVersion.binaryPath << ")" << endl;
+			return false;
+		}
+
 		//Generate the manifest
-		if(!runSchedulerWithFiles(oldVersion.binaryPath.c_str(), finalVersion.binaryPath.c_str(), fullOutput.c_str(), preUpdateHashes, false, false))
+		if(!runSchedulerWithImages(oldImage.data, oldImage.length, finalImage.data, finalImage.length, fullOutput.c_str(), preUpdateHashes, false, false))
 		{
 			cerr << "Couldn't diff with version " << to_string(oldVersion.version) << " (file " << oldVersion.binaryPath << ")" << endl;
 			return false;
 		}
 
+		cout << "Diffed version " << oldVersion.version << ", peak memory usage: " << peakMemoryUsage() << " KiB." << endl;
+
 		//Create the new object in the output JSON file
 		rapidjson::Value versionID, binaryPath, manifestPath;
 
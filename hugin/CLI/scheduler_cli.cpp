@@ -44,59 +44,49 @@ void printSchedulerHelp()
 "	--pageSize value	- Size of the flash pages to be by the scheduler. Value should be the power of two to be used." << endl <<
 "				(e.g. 12 means that the flash is 2^12 bytes = 4KiB" << endl <<
 "				Default value is 12 (i.e. 4096 bytes)" << endl <<
+"	--suffixSort engine	- Suffix sorting algorithm used by the diff, either `sais` (default), `parallel` or `qsufsort`." << endl <<
+"				All generate the same patch, SA-IS is linear and thus faster on large images" << endl <<
+"	--threads value		- Number of threads the diff may use. Also valid in batchMode." << endl <<
+"				If above 1, the suffix sorting defaults to the `parallel` engine and the new image" << endl <<
+"				is scanned in independent 256KiB sections" << endl <<
+"	--suffixCache dir	- Cache the suffix arrays of the original images in dir, and reuse them on later runs." << endl <<
+"				Mostly useful in batchMode, where the same images are diffed release after release" << endl <<
+"	--detectShifts		- Look for long sections of the new image copied from the original before running bsdiff." << endl <<
+"				Faster on large images shifted by the linker, but bsdiff alone usually finds a smaller patch" << endl <<
+"	--portfolio criteria	- Solve the scheduling with several heuristics, and keep the best result. Also valid in batchMode." << endl <<
+"				Criteria is either `size` (smallest commands), `erases` (fewest erases) or `time` (fastest install," << endl <<
+"				estimated from the flashTiming of the batch config). Slower, but uses --threads" << endl <<
+"	--entropyCoding		- Write the commands in the entropy coded format, smaller but requiring a Munin built with" << endl <<
+"				MANIFEST_FORMAT_VERSION set to MANIFEST_FORMAT_ENTROPY_CODED. In batchMode, set entropyCoding in the config instead" << endl <<
+"	--checkpoints		- Precede the commands with checkpoints, so that Munin resumes quickly after a power loss. Requires a Munin" << endl <<
+"				built with MANIFEST_FORMAT_VERSION set to MANIFEST_FORMAT_CHECKPOINTED. In batchMode, set checkpoints in the config instead" << endl <<
 "	--diffAndSign" << endl << endl;
 }
 
-bool runSchedulerWithFiles(const char * oldFile, const char * newFile, const char * output, vector<VerificationRange> & preUpdateHashes, bool printLog, bool dryRun)
+bool runSchedulerWithImages(const uint8_t * oldImage, size_t oldImageSize, const uint8_t * newImage, size_t newImageSize, const char * output, vector<VerificationRange> & preUpdateHashes, bool printLog, bool dryRun)
 {
-	if(oldFile == nullptr || newFile == nullptr || (output == nullptr && !dryRun))
-	{
-		printSchedulerHelp();
-		return false;
-	}
-
 	SchedulerPatch patch{};
 
-	size_t oldFileSize, newFileSize;
-
-	uint8_t * oldFileContent = readFile(oldFile, &oldFileSize);
-	if(oldFileContent == nullptr)
-	{
-		cerr << "Couldn't read the old firmware file" << endl;
-		return false;
-	}
-
-	uint8_t * newFileContent = readFile(newFile, &newFileSize);
-	if(newFileContent == nullptr)
-	{
-		cerr << "Couldn't read the new firmware file" << endl;
-		return false;
-	}
-
-	bool retValue = true;
-
 	//Generate the patch
-	if(!generatePatch(oldFileContent, oldFileSize, newFileContent, newFileSize, patch, printLog))
+	if(!generatePatch(oldImage, oldImageSize, newImage, newImageSize, patch, printLog))
 	{
 		cerr << "Couldn't diff the two firmware images. Please open a bug report!" << endl;
-		retValue = false;
-		goto cleanup;
+		return false;
 	}
 
 	//If the files are identical, we're done
 	if(patch.bsdiff.empty())
-	{
-		goto cleanup;
-	}
+		return true;
 
 	//Perform semantic validations
-	if(!validateSchedulerPatch(oldFileContent, oldFileSize, newFileContent, newFileSize, patch))
+	if(!validateSchedulerPatch(oldImage, oldImageSize, newImage, newImageSize, patch))
 	{
 		cerr << "Couldn't validate the diff between the two images. Please open a bug report!" << endl;
-		retValue = false;
-		goto cleanup;
+		return false;
 	}
 
+	bool retValue = true;
+
 	//Restrict outputFile's scope
 	if(!dryRun)
 	{
@@ -107,14 +97,33 @@ bool runSchedulerWithFiles(const char * oldFile, const char * newFile, const cha
 	}
 
 	preUpdateHashes = patch.oldRanges;
-	patch.clear(true);
+	return retValue;
+}
+
+bool runSchedulerWithFiles(const char * oldFile, const char * newFile, const char * output, vector<VerificationRange> & preUpdateHashes, bool printLog, bool dryRun)
+{
+	if(oldFile == nullptr || newFile == nullptr || (output == nullptr && !dryRun))
+	{
+		printSchedulerHelp();
+		return false;
+	}
 
-cleanup:
+	//The images are mapped, and never copied
+	ImageFile oldImage, newImage;
 
-	free(newFileContent);
-	free(oldFileContent);
+	if(!oldImage.open(oldFile))
+	{
+		cerr << "Couldn't read the old firmware file" << endl;
+		return false;
+	}
 
-	return retValue;
+	if(!newImage.open(newFile))
+	{
+		cerr << "Couldn't read the new firmware file" << endl;
+		return false;
+	}
+
+	return runSchedulerWithImages(oldImage.data, oldImage.length, newImage.data, newImage.length, output, preUpdateHashes, printLog, dryRun);
 }
 
 bool writeVerifRangeToFile(const vector<VerificationRange> & preUpdateHashes, const string &outputFile)
@@ -133,6 +142,28 @@ bool writeVerifRangeToFile(const vector<VerificationRange> & preUpdateHashes, co
 	return true;
 }
 
+static void setThreadCount(const char * argument)
+{
+	int threadCount = atoi(argument);
+
+	if(threadCount > 0)
+		_realThreadCount = static_cast<size_t>(threadCount);
+	else
+		cerr << "Invalid thread count: " << argument << endl;
+}
+
+static void setPortfolioMode(const char * argument)
+{
+	if(!strcmp(argument, "size"))
+		_portfolioMode = PORTFOLIO_SMALLEST_STREAM;
+	else if(!strcmp(argument, "erases"))
+		_portfolioMode = PORTFOLIO_FEWEST_ERASES;
+	else if(!strcmp(argument, "time"))
+		_portfolioMode = PORTFOLIO_FASTEST_INSTALL;
+	else
+		cerr << "Invalid portfolio criteria: " << argument << endl;
+}
+
 bool processScheduler(int argc, char *argv[])
 {
 	int index = 1;
@@ -153,6 +184,25 @@ bool processScheduler(int argc, char *argv[])
 				output = argv[index + 1];
 				index += 1;
 			}
+			else if(!strcmp(argv[index], "--threads") && index + 1 < argc)
+			{
+				setThreadCount(argv[index + 1]);
+				index += 1;
+			}
+			else if(!strcmp(argv[index], "--portfolio") && index + 1 < argc)
+			{
+				setPortfolioMode(argv[index + 1]);
+				index += 1;
+			}
+			else if(!strcmp(argv[index], "--suffixCache") && index + 1 < argc)
+			{
+				_suffixArrayCacheDir = argv[index + 1];
+				index += 1;
+			}
+			else if(!strcmp(argv[index], "--detectShifts"))
+			{
+				_detectShiftedRuns = true;
+			}
 			else
 			{
 				cerr << "Invalid argument: " << argv[index] << endl;
@@ -166,12 +216,15 @@ bool processScheduler(int argc, char *argv[])
 			return false;
 		}
 
+		if(_realThreadCount > 1)
+			_suffixSortEngine = SUFFIX_SORT_PARALLEL;
+
 		return processSchedulerBatch(config, output);
 	}
 	else
 	{
 		const char * oldFile = nullptr, * newFile = nullptr;
-		bool wantLog = false, dryRun = false;
+		bool wantLog = false, dryRun = false, engineSelected = false;
 		while(index < argc)
 		{
 			if((!strcmp(argv[index], "--original") || !strcmp(argv[index], "-v1")) && index + 1 < argc)
@@ -220,12 +273,59 @@ bool processScheduler(int argc, char *argv[])
 				_realBlockSizeBit = static_cast<size_t>(atoi(argv[index + 1]));
 				index += 2;
 			}
+			else if(!strcmp(argv[index], "--suffixSort") && index + 1 < argc)
+			{
+				if(!strcmp(argv[index + 1], "qsufsort"))
+					_suffixSortEngine = SUFFIX_SORT_QSUFSORT;
+				else if(!strcmp(argv[index + 1], "sais"))
+					_suffixSortEngine = SUFFIX_SORT_SAIS;
+				else if(!strcmp(argv[index + 1], "parallel"))
+					_suffixSortEngine = SUFFIX_SORT_PARALLEL;
+				else
+					cerr << "Invalid suffix sorting engine: " << argv[index + 1] << endl;
+
+				engineSelected = true;
+				index += 2;
+			}
+			else if(!strcmp(argv[index], "--threads") && index + 1 < argc)
+			{
+				setThreadCount(argv[index + 1]);
+				index += 2;
+			}
+			else if(!strcmp(argv[index], "--portfolio") && index + 1 < argc)
+			{
+				setPortfolioMode(argv[index + 1]);
+				index += 2;
+			}
+			else if(!strcmp(argv[index], "--suffixCache") && index + 1 < argc)
+			{
+				_suffixArrayCacheDir = argv[index + 1];
+				index += 2;
+			}
+			else if(!strcmp(argv[index], "--detectShifts"))
+			{
+				_detectShiftedRuns = true;
+				index += 1;
+			}
+			else if(!strcmp(argv[index], "--entropyCoding"))
+			{
+				_manifestFormat = MANIFEST_FORMAT_ENTROPY_CODED;
+				index += 1;
+			}
+			else if(!strcmp(argv[index], "--checkpoints"))
+			{
+				_manifestFormat = MANIFEST_FORMAT_CHECKPOINTED;
+				index += 1;
+			}
 			else
 			{
 				cerr << "Invalid argument: " << argv[index++] << endl;
 			}
 		}
 
+		if(!engineSelected && _realThreadCount > 1)
+			_suffixSortEngine = SUFFIX_SORT_PARALLEL;
+
 		vector<VerificationRange> preUpdateHashes;
 
 		if(!runSchedulerWithFiles(oldFile, newFile, output, preUpdateHashes, wantLog, dryRun))
@@ -35,6 +35,7 @@ void printAuthenticationHelp();
 bool processAuthentication(int argc, char *argv[]);
 
 #ifdef RAVENS_PUBLIC_COMMAND_H
+	bool runSchedulerWithImages(const uint8_t * oldImage, size_t oldImageSize, const uint8_t * newImage, size_t newImageSize, const char * output, std::vector<VerificationRange> & preUpdateHashes, bool printLog, bool dryRun);
 	bool runSchedulerWithFiles(const char * oldFile, const char * newFile, const char * output, std::vector<VerificationRange> & preUpdateHashes, bool printLog, bool dryRun);
 	bool processSchedulerBatch(const char * configFile, char * outputDir);
 	bool parseConfig(const char * configFile, bool wantManifests, std::vector<VersionData> & output, size_t & flashSize, size_t & flashPageSize);
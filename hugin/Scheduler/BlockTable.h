@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+#ifndef RAVENS_BLOCK_TABLE_H
+#define RAVENS_BLOCK_TABLE_H
+
+//Map from the BlockID of a set of blocks to a value, without hashing
+//	Blocks are pages of the flash, so the page number (relative to the first block) indexes a slot array pointing to values stored contiguously
+//	The range of blocks is set when building the table, BlockIDs outside of it (the cache...) are simply never found
+template<typename T>
+class BlockTable
+{
+	enum : uint32_t { NO_SLOT = UINT32_MAX };
+
+	size_t firstPage;
+	vector<uint32_t> slots;
+	vector<T> values;
+
+	size_t slotForBlock(const BlockID & block) const
+	{
+		//Blocks before the first page wrap around and end up out of range as well
+		return (block.value >> BLOCK_SIZE_BIT) - firstPage;
+	}
+
+	template<typename Iterator, typename BlockForItem>
+	void reserveRange(Iterator begin, Iterator end, size_t count, const BlockForItem & blockForItem)
+	{
+		firstPage = 0;
+		if(begin == end)
+			return;
+
+		size_t lastPage = 0;
+		firstPage = SIZE_MAX;
+		for(Iterator iter = begin; iter != end; ++iter)
+		{
+			const size_t page = blockForItem(*iter).value >> BLOCK_SIZE_BIT;
+			firstPage = MIN(firstPage, page);
+			lastPage = MAX(lastPage, page);
+		}
+
+		slots.assign(lastPage - firstPage + 1, NO_SLOT);
+		values.reserve(count);
+	}
+
+public:
+	explicit BlockTable(const vector<Block> & blocks)
+	{
+		reserveRange(blocks.cbegin(), blocks.cend(), blocks.size(), [](const Block & block) -> const BlockID & { return block.blockID; });
+	}
+
+	BlockTable(const vector<Block> & blocks, const vector<size_t> & indexes)
+	{
+		reserveRange(indexes.cbegin(), indexes.cend(), indexes.size(), [&blocks](const size_t & index) -> const BlockID & { return blocks[index].blockID; });
+	}
+
+	T * find(const BlockID & block)
+	{
+		const size_t slot = slotForBlock(block);
+		if(slot >= slots.size() || slots[slot] == NO_SLOT)
+			return nullptr;
+
+		return &values[slots[slot]];
+	}
+
+	const T * find(const BlockID & block) const
+	{
+		return const_cast<BlockTable *>(this)->find(block);
+	}
+
+	//Insert a default value if the block isn't in the table yet. The block must be within the range the table was built for
+	T & operator[](const BlockID & block)
+	{
+		const size_t slot = slotForBlock(block);
+		assert(slot < slots.size());
+
+		if(slots[slot] == NO_SLOT)
+		{
+			slots[slot] = (uint32_t) values.size();
+			values.emplace_back();
+		}
+
+		return values[slots[slot]];
+	}
+};
+
+#endif //RAVENS_BLOCK_TABLE_H
@@ -21,34 +21,6 @@
 #include <decoder.h>
 #include <sys/param.h>
 
-void Encoder::writeBits(const uint64_t & bitsToWrite, const uint8_t & lengthToWrite, std::vector<uint64_t> & bitField, uint8_t & bitWidth) const
-{
-	if(lengthToWrite == 0)
-		return;
-
-	assert(bitWidth + lengthToWrite <= UINT8_MAX);
-
-	//Will this instruction make us use a new qword?
-	const uint8_t nbBitsInQword = 8 * sizeof(uint64_t);
-	const uint8_t spaceLeft = nbBitsInQword - (bitWidth % nbBitsInQword);
-
-	if(lengthToWrite <= spaceLeft)
-	{
-		uint64_t & qword = bitField.back();
-		qword <<= lengthToWrite;
-		qword |= bitsToWrite & MASK_OF_WIDTH(lengthToWrite);
-		bitWidth += lengthToWrite;
-	}
-	else
-	{
-		const uint64_t bitsToWriteInFirstBatch = bitsToWrite >> (lengthToWrite - spaceLeft);
-		writeBits(bitsToWriteInFirstBatch, spaceLeft, bitField, bitWidth);
-
-		bitField.push_back(0);
-		writeBits(bitsToWrite, lengthToWrite - spaceLeft, bitField, bitWidth);
-	}
-}
-
 uint64_t Encoder::extractBlockID(const uint64_t & address) const
 {
 	uint64_t output = (address - blockBase.value) >> BLOCK_SIZE_BIT;
@@ -56,51 +28,47 @@ uint64_t Encoder::extractBlockID(const uint64_t & address) const
 	return output;
 }
 
-void Encoder::encodeInstruction(const PublicCommand & command, uint8_t & bitLength, std::vector<uint64_t> & instruction)
+template<typename Output>
+void Encoder::encodeInstruction(const PublicCommand & command, Output & output)
 {
-	instruction.clear();
-	instruction.push_back(0);
-
-	bitLength = 0;
-
 	switch (command.command)
 	{
 		case ERASE:
 		{
-			writeBits(OPCODE_ERASE, INSTRUCTION_WIDTH, instruction, bitLength);
+			output.write(OPCODE_ERASE, INSTRUCTION_WIDTH, FIELD_OPCODE);
 
 			if(!usingBlock)
-				writeBits(extractBlockID(command.mainAddress), blockIDBits, instruction, bitLength);
+				output.write(extractBlockID(command.mainAddress), blockIDBits, FIELD_BLOCK_ID);
 
 			break;
 		}
 
 		case LOAD_AND_FLUSH:
 		{
-			writeBits(OPCODE_LOAD_FLUSH, INSTRUCTION_WIDTH, instruction, bitLength);
+			output.write(OPCODE_LOAD_FLUSH, INSTRUCTION_WIDTH, FIELD_OPCODE);
 
 			if(!usingBlock)
-				writeBits(extractBlockID(command.mainAddress), blockIDBits, instruction, bitLength);
+				output.write(extractBlockID(command.mainAddress), blockIDBits, FIELD_BLOCK_ID);
 			break;
 		}
 
 		case COMMIT:
 		{
-			writeBits(OPCODE_COMMIT, INSTRUCTION_WIDTH, instruction, bitLength);
+			output.write(OPCODE_COMMIT, INSTRUCTION_WIDTH, FIELD_OPCODE);
 
 			if(!usingBlock)
-				writeBits(extractBlockID(command.mainAddress), blockIDBits, instruction, bitLength);
+				output.write(extractBlockID(command.mainAddress), blockIDBits, FIELD_BLOCK_ID);
 			break;
 		}
 
 		case FLUSH_AND_PARTIAL_COMMIT:
 		{
-			writeBits(OPCODE_FLUSH_COMMIT, INSTRUCTION_WIDTH, instruction, bitLength);
+			output.write(OPCODE_FLUSH_COMMIT, INSTRUCTION_WIDTH, FIELD_OPCODE);
 
 			if(!usingBlock)
-				writeBits(extractBlockID(command.mainAddress), blockIDBits, instruction, bitLength);
+				output.write(extractBlockID(command.mainAddress), blockIDBits, FIELD_BLOCK_ID);
 
-			writeBits(command.length - 1, BLOCK_SIZE_BIT, instruction, bitLength);
+			output.write(command.length - 1, BLOCK_SIZE_BIT, FIELD_LENGTH);
 			break;
 		}
 
@@ -112,35 +80,35 @@ void Encoder::encodeInstruction(const PublicCommand & command, uint8_t & bitLeng
 			if(isMainCache)
 			{
 				if(isSecCache)
-					writeBits(OPCODE_COPY_CC, INSTRUCTION_WIDTH, instruction, bitLength);
+					output.write(OPCODE_COPY_CC, INSTRUCTION_WIDTH, FIELD_OPCODE);
 
 				else
-					writeBits(OPCODE_COPY_CN, INSTRUCTION_WIDTH, instruction, bitLength);
+					output.write(OPCODE_COPY_CN, INSTRUCTION_WIDTH, FIELD_OPCODE);
 			}
 			else
 			{
 				if(isSecCache)
 				{
-					writeBits(OPCODE_COPY_NC, INSTRUCTION_WIDTH, instruction, bitLength);
+					output.write(OPCODE_COPY_NC, INSTRUCTION_WIDTH, FIELD_OPCODE);
 				}
 				else
 				{
-					writeBits(OPCODE_COPY_NN, INSTRUCTION_WIDTH, instruction, bitLength);
+					output.write(OPCODE_COPY_NN, INSTRUCTION_WIDTH, FIELD_OPCODE);
 				}
 
 				if(!usingBlock)
-					writeBits(extractBlockID(command.mainAddress), blockIDBits, instruction, bitLength);
+					output.write(extractBlockID(command.mainAddress), blockIDBits, FIELD_BLOCK_ID);
 			}
 
-			writeBits(command.mainAddress, BLOCK_SIZE_BIT, instruction, bitLength);
-			writeBits(command.length - 1, BLOCK_SIZE_BIT, instruction, bitLength);
+			output.write(command.mainAddress, BLOCK_SIZE_BIT, FIELD_OFFSET);
+			output.write(command.length - 1, BLOCK_SIZE_BIT, FIELD_LENGTH);
 
 			//Write the second block BlockID if relevant
 			//	We don't write the second BlockID if the first operand was from the cache (as we had no opportunity to use the block mentionned by USE_BLOCK)
 			if(!isSecCache && (!usingBlock || (usingBlock && !isMainCache)))
-				writeBits(extractBlockID(command.secondaryAddress), blockIDBits, instruction, bitLength);
+				output.write(extractBlockID(command.secondaryAddress), blockIDBits, FIELD_BLOCK_ID);
 
-			writeBits(command.secondaryAddress, BLOCK_SIZE_BIT, instruction, bitLength);
+			output.write(command.secondaryAddress, BLOCK_SIZE_BIT, FIELD_OFFSET);
 			break;
 		}
 
@@ -148,37 +116,37 @@ void Encoder::encodeInstruction(const PublicCommand & command, uint8_t & bitLeng
 		{
 			if(command.mainAddress < CACHE_ADDRESS)
 			{
-				writeBits(OPCODE_CHAINED_COPY_N, INSTRUCTION_WIDTH, instruction, bitLength);
+				output.write(OPCODE_CHAINED_COPY_N, INSTRUCTION_WIDTH, FIELD_OPCODE);
 
 				if(!usingBlock)
-					writeBits(extractBlockID(command.mainAddress), blockIDBits, instruction, bitLength);
+					output.write(extractBlockID(command.mainAddress), blockIDBits, FIELD_BLOCK_ID);
 			}
 			else
-				writeBits(OPCODE_CHAINED_COPY_C, INSTRUCTION_WIDTH, instruction, bitLength);
+				output.write(OPCODE_CHAINED_COPY_C, INSTRUCTION_WIDTH, FIELD_OPCODE);
 
-			writeBits(command.mainAddress, BLOCK_SIZE_BIT, instruction, bitLength);
-			writeBits(command.length - 1, BLOCK_SIZE_BIT, instruction, bitLength);
+			output.write(command.mainAddress, BLOCK_SIZE_BIT, FIELD_OFFSET);
+			output.write(command.length - 1, BLOCK_SIZE_BIT, FIELD_LENGTH);
 
 			break;
 		}
 
 		case CHAINED_COPY_SKIP:
 		{
-			writeBits(OPCODE_CHAINED_SKIP, INSTRUCTION_WIDTH, instruction, bitLength);
-			writeBits(command.length - 1, MAX_SKIP_LENGTH_BITS, instruction, bitLength);
+			output.write(OPCODE_CHAINED_SKIP, INSTRUCTION_WIDTH, FIELD_OPCODE);
+			output.write(command.length - 1, MAX_SKIP_LENGTH_BITS, FIELD_SKIP);
 			break;
 		}
 
 		case USE_BLOCK:
 		{
-			writeBits(OPCODE_USE_BLOCK, INSTRUCTION_WIDTH, instruction, bitLength);
-			writeBits(extractBlockID(command.mainAddress), blockIDBits, instruction, bitLength);
+			output.write(OPCODE_USE_BLOCK, INSTRUCTION_WIDTH, FIELD_OPCODE);
+			output.write(extractBlockID(command.mainAddress), blockIDBits, FIELD_BLOCK_ID);
 			usingBlock = true;
 			break;
 		}
 		case RELEASE_BLOCK:
 		{
-			writeBits(OPCODE_RELEASE, INSTRUCTION_WIDTH, instruction, bitLength);
+			output.write(OPCODE_RELEASE, INSTRUCTION_WIDTH, FIELD_OPCODE);
 			usingBlock = false;
 			break;
 		}
@@ -189,9 +157,9 @@ void Encoder::encodeInstruction(const PublicCommand & command, uint8_t & bitLeng
 
 			assert(numberOfBitsNecessary(blockIDBits - 1u) <= REBASE_LENGTH_BITS);
 
-			writeBits(OPCODE_REBASE, INSTRUCTION_WIDTH, instruction, bitLength);
-			writeBits(extractBlockID(command.mainAddress), BLOCK_ID_SPACE, instruction, bitLength);
-			writeBits(blockIDBits - 1u, REBASE_LENGTH_BITS, instruction, bitLength);
+			output.write(OPCODE_REBASE, INSTRUCTION_WIDTH, FIELD_OPCODE);
+			output.write(extractBlockID(command.mainAddress), BLOCK_ID_SPACE, FIELD_REBASE);
+			output.write(blockIDBits - 1u, REBASE_LENGTH_BITS, FIELD_REBASE);
 
 			blockBase = command.mainAddress;
 			break;
@@ -199,90 +167,247 @@ void Encoder::encodeInstruction(const PublicCommand & command, uint8_t & bitLeng
 
 		case END_OF_STREAM:
 		{
-			writeBits(OPCODE_END_OF_STREAM, INSTRUCTION_WIDTH, instruction, bitLength);
+			output.write(OPCODE_END_OF_STREAM, INSTRUCTION_WIDTH, FIELD_OPCODE);
 			break;
 		}
 	}
 }
 
-void Encoder::appendInstruction(const PublicCommand & command, uint8_t & currentByte, uint8_t & spaceLeftInByte, std::vector<uint8_t> &byteStream)
+void Encoder::encode(const std::vector<PublicCommand> & commands, uint8_t* & _byteField, size_t & length)
 {
-	uint8_t bitLength;
-	std::vector<uint64_t> instruction;
+	FlashGeometryScope geometryScope(geometry);
+	reset();
 
-	encodeInstruction(command, bitLength, instruction);
+	if(entropyCoded)
+	{
+		_byteField = encodeEntropy(commands, false, length);
+		return;
+	}
+
+	//Most instructions fit in 4 bytes, the buffer grows if needed
+	BitWriter output(4 * commands.size() + 8);
 
-	//We append the qword one by one
-	for(uint64_t qword : instruction)
+	for(const auto & command : commands)
+		encodeInstruction(command, output);
+
+	//The stream must finish with at least INSTRUCT_WIDTH worth of 1 to be parsed as OPCODE_END_OF_STREAM
+	const uint8_t spaceLeftInByte = output.spaceLeftInByte();
+	if(spaceLeftInByte == 8 || spaceLeftInByte < INSTRUCTION_WIDTH)
 	{
-		//We get the relevant length
-		uint8_t qwordLength = MIN(bitLength, 8 * sizeof(qword));
-		bitLength -= qwordLength;
+		encodeInstruction(PublicCommand{
+				.command = END_OF_STREAM,
+				.mainAddress = 0,
+				.secondaryAddress = 0,
+				.length = 0
+		}, output);
+	}
+
+	//The last byte partially in use is padded with ones
+	_byteField = output.finish(length);
 
-		//We convert the instruction to big endian (the stronger bits i.e. the opcode first)
-		while(qwordLength > spaceLeftInByte)
+	if(checkpointed && _byteField != nullptr)
+		_byteField = prependCheckpoints(_byteField, length);
+}
+
+static bool isErasing(INSTR command)
+{
+	return command == ERASE || command == LOAD_AND_FLUSH || command == FLUSH_AND_PARTIAL_COMMIT;
+}
+
+//A checkpoint is recorded before every CHECKPOINT_INTERVAL erases, except the first one as it would be the beginning of the stream
+static size_t checkpointTableSize(size_t erases)
+{
+	const size_t numberCheckpoints = erases != 0 ? (erases - 1) / CHECKPOINT_INTERVAL : 0;
+	return sizeof(uint16_t) + numberCheckpoints * sizeof(DecoderCheckpoint);
+}
+
+uint8_t * Encoder::prependCheckpoints(uint8_t * commands, size_t & length) const
+{
+	//We replay the stream as Munin would, in order to record its exact state before the erases
+	DecoderContext context = {
+			.usingBlock = false,
+			.blockInUse = 0,
+			.blockIDBits = BLOCK_ID_SPACE,
+			.blockBase = BLOCK_ID_SPACE,
+			.blockIDBitsRef = BLOCK_ID_SPACE,
+			.blockSizeBitsRef = BLOCK_SIZE_BIT,
+			.entropy = nullptr
+	};
+
+	std::vector<DecoderCheckpoint> checkpoints;
+	DecoderCheckpoint state = {};
+	size_t currentOffset = 0, traceCounter = 0, chainAddress = 0, erases = 0;
+	bool chainIsCache = false;
+	DecodedCommand command;
+
+	while(true)
+	{
+		state.bitOffset = (uint32_t) currentOffset;
+		state.traceCounter = (uint32_t) traceCounter;
+		state.chainAddress = (uint32_t) chainAddress;
+		state.chainIsCache = chainIsCache;
+		saveCheckpoint(&context, &state);
+
+		if(!decodeInstruction(&context, commands, &currentOffset, length, &command) || command.command == OPCODE_END_OF_STREAM)
+			break;
+
+		//Same bookkeeping as processInstruction: each erase moves the trace counter twice, copies set the address used by the next chained copy
+		switch(command.command)
 		{
-			//We fill currentByte
+			case OPCODE_ERASE:
+			case OPCODE_LOAD_FLUSH:
+			case OPCODE_FLUSH_COMMIT:
+			{
+				if(erases != 0 && erases % CHECKPOINT_INTERVAL == 0)
+					checkpoints.push_back(state);
 
-			//	bitLength - spaceLeftInByte gives us the shift we need to have `spaceLeftInByte` usefull bytes
-			//	We mask to ignore stronger bits
+				erases += 1;
+				traceCounter += 2;
 
-			currentByte |= (qword >> (qwordLength - spaceLeftInByte)) & MASK_OF_WIDTH(spaceLeftInByte);
-			qwordLength -= spaceLeftInByte;
+				if(command.command == OPCODE_LOAD_FLUSH)
+				{
+					chainIsCache = true;
+					chainAddress = BLOCK_SIZE;
+				}
+				else if(command.command == OPCODE_FLUSH_COMMIT)
+				{
+					chainIsCache = false;
+					chainAddress = command.mainAddress + command.length;
+				}
+				break;
+			}
 
-			//Commit the byte
-			byteStream.push_back(currentByte);
+			case OPCODE_COMMIT:
+			{
+				chainIsCache = false;
+				chainAddress = command.mainAddress + BLOCK_SIZE;
+				break;
+			}
+
+			case OPCODE_COPY_NN:
+			case OPCODE_COPY_NC:
+			case OPCODE_COPY_CN:
+			case OPCODE_COPY_CC:
+			{
+				chainIsCache = command.command == OPCODE_COPY_NC || command.command == OPCODE_COPY_CC;
+				chainAddress = command.secondaryAddress + command.length;
+				break;
+			}
+
+			case OPCODE_CHAINED_COPY_N:
+			case OPCODE_CHAINED_COPY_C:
+			case OPCODE_CHAINED_SKIP:
+			{
+				chainAddress += command.length;
+				break;
+			}
 
-			//Reset the byte
-			currentByte = 0;
-			spaceLeftInByte = 8;
+			default:
+				break;
 		}
+	}
+
+	assert(checkpoints.size() < UINT16_MAX && traceCounter < UINT32_MAX && (length << 3u) < UINT32_MAX);
 
-		//We can then shove the bits left in the most significant bits of currentByte
-		//Assuming spaceLeftInByte is 7 (strongest bit in use) and bitLength is 6 (on bit will be left untouched)
-		//	This would me equivalent to (6 lowest bits of instructions) << 1
+	const size_t tableLength = checkpointTableSize(erases);
+	assert(tableLength == sizeof(uint16_t) + checkpoints.size() * sizeof(DecoderCheckpoint));
 
-		currentByte |= (qword & MASK_OF_WIDTH(qwordLength)) << (spaceLeftInByte - qwordLength);
-		spaceLeftInByte -= qwordLength;
+	auto * output = (uint8_t *) malloc(tableLength + length);
+	if(output != nullptr)
+	{
+		//Offsets are relative to the beginning of the table
+		for(auto & checkpoint : checkpoints)
+			checkpoint.bitOffset += tableLength << 3u;
+
+		const auto numberCheckpoints = (uint16_t) checkpoints.size();
+		memcpy(output, &numberCheckpoints, sizeof(numberCheckpoints));
+		memcpy(&output[sizeof(numberCheckpoints)], checkpoints.data(), checkpoints.size() * sizeof(DecoderCheckpoint));
+		memcpy(&output[tableLength], commands, length);
 	}
+
+	free(commands);
+	length += tableLength;
+	return output;
 }
 
-void Encoder::encode(const std::vector<PublicCommand> & commands, uint8_t* & _byteField, size_t & length)
+uint8_t * Encoder::encodeEntropy(const std::vector<PublicCommand> & commands, bool countOnly, size_t & length)
 {
-	reset();
-
-	std::vector<uint8_t> byteField;
-	uint8_t currentByte = 0, spaceLeftInByte = 8;
+	//Instructions take a bit more than 2 bytes on average
+	RangeWriter output(3 * commands.size() + 16, countOnly);
 
 	for(const auto & command : commands)
-		appendInstruction(command, currentByte, spaceLeftInByte, byteField);
+		encodeInstruction(command, output);
 
-	//The stream must finish with at least INSTRUCT_WIDTH worth of 1 to be parsed as OPCODE_END_OF_STREAM
-	if(spaceLeftInByte == 8 || spaceLeftInByte < INSTRUCTION_WIDTH)
-	{
-		appendInstruction(PublicCommand{
-				.command = END_OF_STREAM,
-				.mainAddress = 0,
-				.secondaryAddress = 0,
-				.length = 0
-		}, currentByte, spaceLeftInByte, byteField);
-	}
+	//The stream always ends with an END_OF_STREAM, there is no padding to rely on
+	encodeInstruction(PublicCommand{
+			.command = END_OF_STREAM,
+			.mainAddress = 0,
+			.secondaryAddress = 0,
+			.length = 0
+	}, output);
 
-	//currentByte partially in use, we pad it with ones
-	if(spaceLeftInByte != 8)
-	{
-		currentByte |= MASK_OF_WIDTH(spaceLeftInByte);
-		byteField.push_back(currentByte);
-	}
+	return output.finish(length);
+}
 
-	length = byteField.size();
-	_byteField = (uint8_t *) malloc(length);
-	if(_byteField != nullptr)
+size_t Encoder::measure(const std::vector<PublicCommand> & commands)
+{
+	FlashGeometryScope geometryScope(geometry);
+
+	if(entropyCoded)
 	{
-		size_t index = 0;
-		for(const auto & byte : byteField)
-			_byteField[index++] = byte;
+		size_t length;
+		reset();
+		encodeEntropy(commands, true, length);
+		return length;
 	}
+
+	startMeasure();
+
+	for(const auto & command : commands)
+		_measureAppend(command);
+
+	return measuredLength();
+}
+
+void Encoder::startMeasure()
+{
+	assert(!entropyCoded);
+	reset();
+	measuredBits = measuredErases = 0;
+}
+
+size_t Encoder::measureAppend(const PublicCommand & command)
+{
+	FlashGeometryScope geometryScope(geometry);
+	return _measureAppend(command);
+}
+
+size_t Encoder::_measureAppend(const PublicCommand & command)
+{
+	BitCounter counter;
+	encodeInstruction(command, counter);
+
+	measuredBits += counter.bits;
+	if(isErasing(command.command))
+		measuredErases += 1;
+
+	return counter.bits;
+}
+
+size_t Encoder::measuredLength() const
+{
+	//Same termination as encode: an END_OF_STREAM if the padding can't hold one, then padding to a byte
+	size_t bits = measuredBits;
+	const size_t spaceLeftInByte = 8u - bits % 8u;
+
+	if(spaceLeftInByte == 8 || spaceLeftInByte < INSTRUCTION_WIDTH)
+		bits += INSTRUCTION_WIDTH;
+
+	size_t length = (bits + 7u) / 8u;
+	if(checkpointed)
+		length += checkpointTableSize(measuredErases);
+
+	return length;
 }
 
 bool Encoder::_decodeInstruction(const uint8_t * byteStream, size_t & currentByteOffset, const size_t length, PublicCommand & command)
@@ -294,7 +419,8 @@ bool Encoder::_decodeInstruction(const uint8_t * byteStream, size_t & currentByt
 			.blockIDBits = blockIDBits,
 			.blockBase = blockBase.value,
 			.blockIDBitsRef = BLOCK_ID_SPACE,
-			.blockSizeBitsRef = BLOCK_SIZE_BIT
+			.blockSizeBitsRef = BLOCK_SIZE_BIT,
+			.entropy = entropyDecoder
 	};
 
 	decodeInstruction(&decoderContext, byteStream, &currentByteOffset, length, &cCommand);
@@ -394,14 +520,36 @@ bool Encoder::_decodeInstruction(const uint8_t * byteStream, size_t & currentByt
 
 void Encoder::decode(const uint8_t * byteField, size_t length, std::vector<PublicCommand> & commands)
 {
+	FlashGeometryScope geometryScope(geometry);
 	reset();
 
-	PublicCommand command = {};
+	EntropyDecoder decoder;
+	if(entropyCoded)
+	{
+		if(!initEntropyDecoder(&decoder, byteField, length))
+			return;
+
+		entropyDecoder = &decoder;
+	}
+
+	//The commands follow the checkpoint table
 	size_t currentOffset = 0;
+	if(checkpointed)
+	{
+		const size_t tableLength = checkpointTableLength(byteField, length);
+		if(tableLength == 0)
+			return;
+
+		currentOffset = tableLength << 3u;
+	}
+
+	PublicCommand command = {};
 	while(_decodeInstruction(byteField, currentOffset, length, command))
 	{
 		commands.push_back(command);
 	}
+
+	entropyDecoder = nullptr;
 }
 
 size_t Encoder::validate(const std::vector<PublicCommand> & commands)
@@ -414,6 +562,13 @@ size_t Encoder::validate(const std::vector<PublicCommand> & commands)
 	if(bytes == nullptr)
 		return 0;
 
+	//The estimates used by the scheduler must match the real stream
+	if(measure(commands) != length)
+	{
+		free(bytes);
+		return 0;
+	}
+
 	std::vector<PublicCommand> newCommands;
 	decode(bytes, length, newCommands);
 
@@ -13,13 +13,283 @@
 #ifndef SCHEDULER_ENCODER_H
 #define SCHEDULER_ENCODER_H
 
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <decoder.h>
 #include "../public_command.h"
 #include "../Address.h"
 
 uint8_t numberOfBitsNecessary(size_t x);
 
+//Growable malloc'd buffer receiving the encoded stream, or only counting the bytes
+//	If an allocation fails, the content is dropped and the caller gets a nullptr
+class OutputBuffer
+{
+	uint8_t * buffer;
+	size_t capacity;
+	size_t length;
+	bool countOnly;
+	bool failed;
+
+	bool grow(size_t extraLength)
+	{
+		const size_t newCapacity = std::max(2 * capacity, length + extraLength);
+		auto * newBuffer = (uint8_t *) realloc(buffer, newCapacity);
+
+		if(newBuffer == nullptr)
+		{
+			free(buffer);
+			buffer = nullptr;
+			capacity = length = 0;
+			failed = true;
+			return false;
+		}
+
+		buffer = newBuffer;
+		capacity = newCapacity;
+		return true;
+	}
+
+public:
+	OutputBuffer(size_t expectedLength, bool countOnly) : buffer(nullptr), capacity(0), length(0), countOnly(countOnly), failed(false)
+	{
+		if(!countOnly)
+			grow(std::max<size_t>(expectedLength, 64u));
+	}
+
+	OutputBuffer(const OutputBuffer &) = delete;
+	OutputBuffer & operator=(const OutputBuffer &) = delete;
+	~OutputBuffer()	{	free(buffer);	}
+
+	void push(uint8_t byte)
+	{
+		if(countOnly)
+			length += 1;
+		else if(!failed && (length < capacity || grow(1)))
+			buffer[length++] = byte;
+	}
+
+	size_t size() const		{	return length;	}
+	uint8_t * data()		{	return buffer;	}
+
+	uint8_t * take(size_t & outputLength)
+	{
+		uint8_t * output = buffer;
+		outputLength = length;
+
+		buffer = nullptr;
+		capacity = length = 0;
+		return output;
+	}
+};
+
+//Pack fields MSB first (the opcode being the first bit of the stream), for the fixed width format
+//	Bits are gathered in a 64 bits accumulator, and only moved to the buffer by whole bytes when it is about to overflow
+class BitWriter
+{
+	OutputBuffer output;
+
+	uint64_t accumulator;
+	uint8_t pendingBits;
+
+	void flushBytes()
+	{
+		while(pendingBits >= 8)
+		{
+			pendingBits -= 8;
+			output.push((uint8_t) (accumulator >> pendingBits));
+		}
+	}
+
+public:
+	explicit BitWriter(size_t expectedLength) : output(expectedLength, false), accumulator(0), pendingBits(0) {}
+
+	void write(uint64_t bits, uint8_t width, FieldKind kind)
+	{
+		//Larger fields are written in two batches, so that the accumulator can always receive them after a flush
+		if(width > 56)
+		{
+			write(bits >> 32u, width - 32u, kind);
+			width = 32;
+		}
+
+		if(width == 0)
+			return;
+
+		if(pendingBits + width > 64)
+			flushBytes();
+
+		accumulator = (accumulator << width) | (bits & ((1ull << width) - 1u));
+		pendingBits += width;
+	}
+
+	//Bits left before the stream reaches a byte boundary (8 if already aligned)
+	uint8_t spaceLeftInByte() const	{	return (uint8_t) (8u - pendingBits % 8u);	}
+
+	//Pad the last byte with ones, then hand over the buffer (nullptr if an allocation failed)
+	uint8_t * finish(size_t & outputLength)
+	{
+		if(pendingBits % 8u != 0)
+			write(UINT64_MAX, spaceLeftInByte(), FIELD_OPCODE);
+
+		flushBytes();
+		return output.take(outputLength);
+	}
+};
+
+//Same interface as BitWriter, but only counts the bits
+struct BitCounter
+{
+	size_t bits;
+
+	BitCounter() : bits(0) {}
+	void write(uint64_t, uint8_t width, FieldKind)	{	bits += width;	}
+};
+
+//Range coder of the entropy coded format, mirroring the decoder in common/decoding/decoder.c
+class RangeWriter
+{
+	OutputBuffer output;
+	EntropyModels models;
+
+	uint64_t low;
+	uint32_t range;
+	uint8_t cache;
+	size_t cacheSize;
+
+	//Carries are propagated through the pending 0xFF bytes before they are written
+	void shiftLow()
+	{
+		if((uint32_t) low < 0xFF000000u || (low >> 32u) != 0)
+		{
+			const auto carry = (uint8_t) (low >> 32u);
+			uint8_t byte = cache;
+
+			do
+			{
+				output.push((uint8_t) (byte + carry));
+				byte = 0xFF;
+			} while(--cacheSize != 0);
+
+			cache = (uint8_t) ((uint32_t) low >> 24u);
+		}
+
+		cacheSize += 1;
+		low = (uint32_t) low << 8u;
+	}
+
+	void normalize()
+	{
+		while(range < ENTROPY_TOP_VALUE)
+		{
+			range <<= 8u;
+			shiftLow();
+		}
+	}
+
+	void encodeBit(uint16_t & probability, uint8_t bit)
+	{
+		const uint32_t bound = (range >> ENTROPY_PROBABILITY_BITS) * probability;
+
+		if(bit == 0)
+		{
+			range = bound;
+			probability += ((1u << ENTROPY_PROBABILITY_BITS) - probability) >> ENTROPY_ADAPTATION_SHIFT;
+		}
+		else
+		{
+			low += bound;
+			range -= bound;
+			probability -= probability >> ENTROPY_ADAPTATION_SHIFT;
+		}
+
+		normalize();
+	}
+
+	void encodeDirectBit(uint8_t bit)
+	{
+		range >>= 1u;
+		if(bit)
+			low += range;
+
+		normalize();
+	}
+
+	void encodeTree(uint16_t * probabilities, uint8_t bits, uint32_t value)
+	{
+		uint32_t index = 1;
+
+		while(bits-- > 0)
+		{
+			const auto bit = (uint8_t) ((value >> bits) & 1u);
+			encodeBit(probabilities[index], bit);
+			index = (index << 1u) | bit;
+		}
+	}
+
+public:
+	RangeWriter(size_t expectedLength, bool countOnly) : output(expectedLength, countOnly), low(0), range(UINT32_MAX), cache(0), cacheSize(1)
+	{
+		initEntropyModels(&models);
+
+		//Room for the length of the coded stream
+		for(uint8_t i = 0; i < ENTROPY_HEADER_LENGTH; ++i)
+			output.push(0);
+	}
+
+	void write(uint64_t bits, uint8_t width, FieldKind kind)
+	{
+		auto value = (uint32_t) (bits & ((1ull << width) - 1u));
+
+		if(kind == FIELD_OPCODE)
+		{
+			encodeTree(models.opcode[models.previousOpcode >> 2u], INSTRUCTION_WIDTH, value);
+			models.previousOpcode = (uint8_t) value;
+			return;
+		}
+
+		assert(width <= ENTROPY_MAX_FIELD_WIDTH);
+
+		//BlockIDs are coded as the difference with the previous one, zigzag encoded so that small negative values are small as well
+		if(kind == FIELD_BLOCK_ID)
+		{
+			const uint32_t delta = value - models.previousBlockID;
+			models.previousBlockID = value;
+			value = (delta << 1u) ^ (0u - (delta >> 31u));
+		}
+
+		const uint8_t valueWidth = numberOfBitsNecessary(value);
+		encodeTree(models.width[kind], ENTROPY_WIDTH_BITS, valueWidth);
+
+		for(uint8_t bit = valueWidth > 1 ? valueWidth - 1 : 0; bit-- > 0;)
+			encodeDirectBit((uint8_t) ((value >> bit) & 1u));
+	}
+
+	//Flush the coder and write the length of the stream in front of it
+	uint8_t * finish(size_t & outputLength)
+	{
+		for(uint8_t i = 0; i < 5; ++i)
+			shiftLow();
+
+		const size_t codedLength = output.size() - ENTROPY_HEADER_LENGTH;
+		assert(codedLength <= UINT32_MAX);
+
+		uint8_t * header = output.data();
+		if(header != nullptr)
+		{
+			for(uint8_t i = 0; i < ENTROPY_HEADER_LENGTH; ++i)
+				header[i] = (uint8_t) (codedLength >> (8u * i));
+		}
+
+		return output.take(outputLength);
+	}
+};
+
 class Encoder
 {
+	FlashGeometry geometry;
+
 	bool usingBlock;
 	BlockID blockInUse;
 
@@ -27,12 +297,23 @@ class Encoder
 	uint8_t blockIDBits;
 	BlockID blockBase;
 
-	void writeBits(const uint64_t & bitsToWrite, const uint8_t & lengthToWrite, std::vector<uint64_t> & bitField, uint8_t & bitWidth) const;
+	//Bits of the commands measured since startMeasure, and erases among them
+	size_t measuredBits;
+	size_t measuredErases;
+
+	//Write (and read) the entropy coded format, or the fixed width one with checkpoints
+	bool entropyCoded;
+	bool checkpointed;
+	EntropyDecoder * entropyDecoder;
 
 	uint64_t extractBlockID(const uint64_t & address) const;
 
-	void encodeInstruction(const PublicCommand & command, uint8_t & bitLength, std::vector<uint64_t> & instruction);
-	void appendInstruction(const PublicCommand & command, uint8_t & currentByte, uint8_t & spaceLeftInByte, std::vector<uint8_t> &byteStream);
+	template<typename Output>
+	void encodeInstruction(const PublicCommand & command, Output & output);
+
+	uint8_t * encodeEntropy(const std::vector<PublicCommand> & commands, bool countOnly, size_t & length);
+	uint8_t * prependCheckpoints(uint8_t * commands, size_t & length) const;
+	size_t _measureAppend(const PublicCommand & command);
 	bool _decodeInstruction(const uint8_t * byteStream, size_t & currentByteOffset, size_t length, PublicCommand & command);
 
 	void reset();
@@ -44,7 +325,16 @@ public:
 
 	size_t validate(const std::vector<PublicCommand> & commands);
 
-	Encoder() : usingBlock(false), blockInUse(0), blockIDBits(BLOCK_ID_SPACE), blockBase(0) {}
+	//Length encode would output, without encoding anything
+	size_t measure(const std::vector<PublicCommand> & commands);
+
+	//Incremental form of measure: each call to measureAppend returns how many bits the command adds to the stream
+	//	Only available for the fixed width format, as the range coder doesn't emit whole bits per command
+	void startMeasure();
+	size_t measureAppend(const PublicCommand & command);
+	size_t measuredLength() const;
+
+	explicit Encoder(const FlashGeometry & geometry = FlashGeometry::current(), uint16_t format = MANIFEST_FORMAT_FIXED_WIDTH) : geometry(geometry), usingBlock(false), blockInUse(0), blockIDBits((uint8_t) (geometry.fullAddressSpace - geometry.blockSizeBit)), blockBase(0), measuredBits(0), measuredErases(0), entropyCoded(format == MANIFEST_FORMAT_ENTROPY_CODED), checkpointed(format == MANIFEST_FORMAT_CHECKPOINTED), entropyDecoder(nullptr) {}
 };
 
 #endif //SCHEDULER_ENCODER_H
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+#ifndef RAVENS_INDEXED_HEAP_H
+#define RAVENS_INDEXED_HEAP_H
+
+//Binary max-heap of the keys of items 0 to capacity - 1, whose key can be updated or removed in O(log n)
+//	Equal keys are ordered by ascending item, so that the top is the same as a linear scan keeping the first maximum
+class IndexedMaxHeap
+{
+	vector<size_t> heap;
+	vector<int64_t> keys;
+	vector<size_t> position;
+
+	bool isAbove(size_t a, size_t b) const
+	{
+		return keys[a] > keys[b] || (keys[a] == keys[b] && a < b);
+	}
+
+	void place(size_t item, size_t index)
+	{
+		heap[index] = item;
+		position[item] = index;
+	}
+
+	void siftUp(size_t index)
+	{
+		const size_t item = heap[index];
+		while(index > 0)
+		{
+			const size_t parent = (index - 1) / 2;
+			if(!isAbove(item, heap[parent]))
+				break;
+
+			place(heap[parent], index);
+			index = parent;
+		}
+
+		place(item, index);
+	}
+
+	void siftDown(size_t index)
+	{
+		const size_t item = heap[index];
+		while(true)
+		{
+			size_t child = 2 * index + 1;
+			if(child >= heap.size())
+				break;
+
+			if(child + 1 < heap.size() && isAbove(heap[child + 1], heap[child]))
+				child += 1;
+
+			if(!isAbove(heap[child], item))
+				break;
+
+			place(heap[child], index);
+			index = child;
+		}
+
+		place(item, index);
+	}
+
+public:
+	explicit IndexedMaxHeap(size_t capacity) : keys(capacity, 0), position(capacity, SIZE_MAX)
+	{
+		heap.reserve(capacity);
+	}
+
+	bool empty() const				{	return heap.empty();	}
+	size_t top() const				{	return heap.front();	}
+	bool contains(size_t item) const	{	return position[item] != SIZE_MAX;	}
+
+	//Insert the item, or move it according to its new key
+	void update(size_t item, int64_t key)
+	{
+		if(!contains(item))
+		{
+			keys[item] = key;
+			heap.push_back(item);
+			siftUp(heap.size() - 1);
+			return;
+		}
+
+		const bool wentUp = key > keys[item];
+		keys[item] = key;
+
+		if(wentUp)
+			siftUp(position[item]);
+		else
+			siftDown(position[item]);
+	}
+
+	void remove(size_t item)
+	{
+		if(!contains(item))
+			return;
+
+		const size_t index = position[item];
+		const size_t last = heap.back();
+
+		heap.pop_back();
+		position[item] = SIZE_MAX;
+
+		if(last != item)
+		{
+			place(last, index);
+			siftUp(index);
+			siftDown(position[last]);
+		}
+	}
+};
+
+#endif //RAVENS_INDEXED_HEAP_H
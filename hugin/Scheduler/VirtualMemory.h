@@ -20,6 +20,19 @@
 
 struct CacheMemory : public DetailedBlock
 {
+	//Tagged segments ordered by source, so that segmentInCache doesn't have to rescan the cache for each fragment
+	//	Rebuilt on the next lookup after layoutChanged() was called. Any change made to the segments must call it
+	struct SourceIndexEntry
+	{
+		size_t source;
+		size_t end;
+		size_t position;
+		size_t maxEndSoFar;
+	};
+
+	mutable vector<SourceIndexEntry> sourceIndex;
+	mutable bool sourceIndexValid = false;
+
 	CacheMemory() : DetailedBlock(CACHE_BUF) {}
 	CacheMemory(const BlockID & block) : DetailedBlock(CACHE_BUF)
 	{
@@ -27,16 +40,24 @@ struct CacheMemory : public DetailedBlock
 	}
 	explicit CacheMemory(const DetailedBlock & block) : DetailedBlock(block) {}
 
+	void layoutChanged()
+	{
+		sourceIndexValid = false;
+	}
+
 	void untagAll()
 	{
 		for(auto & segment : segments)
 			segment.tagged = false;
+
+		layoutChanged();
 	}
 
 	void flush()
 	{
 		segments.clear();
 		segments.emplace_back(DetailedBlockMetadata(CACHE_BUF, BLOCK_SIZE));
+		layoutChanged();
 	}
 
 	bool isEmpty() const
@@ -63,65 +84,85 @@ struct CacheMemory : public DetailedBlock
 		return room;
 	}
 
+	void buildSourceIndex() const
+	{
+		sourceIndex.clear();
+		for(size_t position = 0, length = segments.size(); position < length; ++position)
+		{
+			const auto & segment = segments[position];
+			if(segment.tagged && segment.length > 0)
+				sourceIndex.push_back({segment.source.value, segment.source.value + segment.length, position, 0});
+		}
+
+		sort(sourceIndex.begin(), sourceIndex.end(), [](const SourceIndexEntry & a, const SourceIndexEntry & b) {
+			return a.source < b.source || (a.source == b.source && a.position < b.position);
+		});
+
+		//Lets us stop walking backward once no earlier segment can reach the address we're looking for
+		size_t maxEnd = 0;
+		for(auto & entry : sourceIndex)
+		{
+			maxEnd = MAX(maxEnd, entry.end);
+			entry.maxEndSoFar = maxEnd;
+		}
+
+		sourceIndexValid = true;
+	}
+
 	vector<DetailedBlockMetadata> segmentInCache(Address base, size_t length) const
 	{
 		vector<DetailedBlockMetadata> output;
-		size_t skipLength = 0;
 		
 #ifdef VERY_AGGRESSIVE_ASSERT
 		const size_t realLength = length;
 #endif
-		//This algorithm iterate the cache, and look for segments containing its head (base).
-		//	If it can't find its head, it's looking for the shortest `skipLength`, which will be used to skip ahead and mark the ignored area as missing from the cache
+		if(!sourceIndexValid)
+			buildSourceIndex();
+
+		//We look for the segment containing the head (base) of what is left, preferring the first one in the cache if several do.
+		//	If none does, the head isn't in the cache until the closest segment starting after it, which we skip to.
 		//This isn't a straightforward implementation because fragments of the segment we're looking for can be in any order
 
-		for(auto iter = segments.cbegin(); iter != segments.cend() && length != 0;)
+		while(length != 0)
 		{
-			if(iter->tagged && iter->overlapWith(base, length))
+			const auto & next = upper_bound(sourceIndex.cbegin(), sourceIndex.cend(), base.value, [](const size_t & address, const SourceIndexEntry & entry) { return address < entry.source; });
+
+			size_t bestPosition = SIZE_MAX;
+			for(auto iter = next; iter != sourceIndex.cbegin() && (iter - 1)->maxEndSoFar > base.value; --iter)
 			{
-				//The segment we're looking for start after the begining of the cache segment
-				if(iter->source <= base)
-				{
-					const size_t shift = base.getAddress() - iter->source.getAddress();
-					const size_t newSegmentLength = MIN(iter->length - shift, length);
+				const auto & candidate = *(iter - 1);
+				if(candidate.end > base.value && candidate.position < bestPosition)
+					bestPosition = candidate.position;
+			}
 
-					assert(newSegmentLength != 0);
-					output.emplace_back(iter->destination + shift, base, newSegmentLength, true);
+			if(bestPosition != SIZE_MAX)
+			{
+				//The segment we're looking for start after the begining of the cache segment
+				const auto & segment = segments[bestPosition];
+				const size_t shift = base.getAddress() - segment.source.getAddress();
+				const size_t newSegmentLength = MIN(segment.length - shift, length);
 
-					base += newSegmentLength;
-					length -= newSegmentLength;
+				assert(newSegmentLength != 0);
+				output.emplace_back(segment.destination + shift, base, newSegmentLength, true);
 
-					iter = segments.cbegin();
-					skipLength = 0;
-				}
-				else
-				{
-					//We look for the shortest distance we would need to jump forward by to find a new token
-					const size_t skipToToken = iter->source.getAddress() - base.getAddress();
-					if(skipLength == 0 || skipToToken < skipLength)
-						skipLength = skipToToken;
-					iter += 1;
-				}
+				base += newSegmentLength;
+				length -= newSegmentLength;
 			}
-			else
-			{
-				iter += 1;
-			}
-
-			//Does the segment start by a section not in the cache while later parts are?
-			if(iter == segments.cend() && skipLength != 0)
+			else if(next != sourceIndex.cend() && next->source - base.value < length)
 			{
+				//The segment start by a section not in the cache while later parts are
+				const size_t skipLength = next->source - base.value;
 				output.emplace_back(base, skipLength, false);
 
 				base += skipLength;
 				length -= skipLength;
-				iter = segments.cbegin();
-				skipLength = 0;
+			}
+			else
+			{
+				output.emplace_back(base, length, false);
+				length = 0;
 			}
 		}
-
-		if(length)
-			output.emplace_back(base, length, false);
 		
 #ifdef VERY_AGGRESSIVE_ASSERT
 		size_t returnedLength = 0;
@@ -137,12 +178,10 @@ struct CacheMemory : public DetailedBlock
 
 struct TranslationTable
 {
-	unordered_map<BlockID, DetailedBlock> translationData;
+	BlockTable<DetailedBlock> translationData;
 
-	TranslationTable(const vector<Block> &blocks)
+	TranslationTable(const vector<Block> &blocks) : translationData(blocks)
 	{
-		translationData.reserve(blocks.size());
-
 		//Initialize a simple page for each BlockID
 		for (const auto &block : blocks)
 		{
@@ -154,10 +193,8 @@ struct TranslationTable
 		}
 	}
 
-	TranslationTable(const vector<Block> &blocks, const vector<size_t> &indexes)
+	TranslationTable(const vector<Block> &blocks, const vector<size_t> &indexes) : translationData(blocks, indexes)
 	{
-		translationData.reserve(blocks.size());
-
 		//Initialize a simple page for each BlockID
 		for (const auto index : indexes)
 		{
@@ -174,11 +211,11 @@ struct TranslationTable
 		assert(length > 0);
 
 		auto translationArray = translationData.find(addressToRedirect.getBlock());
-		if(translationArray != translationData.end())
+		if(translationArray != nullptr)
 		{
 			//Translations must fit in a single page
 			assert((addressToRedirect.value & BLOCK_OFFSET_MASK) + length <= BLOCK_SIZE);
-			translationArray->second.insertNewSegment(DetailedBlockMetadata(newBaseAddress, addressToRedirect, length, true));
+			translationArray->insertNewSegment(DetailedBlockMetadata(newBaseAddress, addressToRedirect, length, true));
 		}
 	}
 
@@ -202,12 +239,12 @@ struct TranslationTable
 		const auto currentTranslation = translationData.find(from.getBlock());
 
 		//The address is outside the virtual memory
-		if(currentTranslation == translationData.end())
+		if(currentTranslation == nullptr)
 		{
 			return processing(from, length);
 		}
 
-		const auto & currentTranslationData = currentTranslation->second.segments;
+		const auto & currentTranslationData = currentTranslation->segments;
 
 		auto iter = lower_bound(currentTranslationData.begin(), currentTranslationData.end(), from, [](const DetailedBlockMetadata & a, const Address from) { return a.destination.value < from.value; });
 		while(iter != currentTranslationData.begin() && (iter - 1)->fitWithinDestination(from))
@@ -332,6 +369,8 @@ struct VirtualMemory
 				assert(length == 0);
 				for(const auto & untag : untagSegments)
 					cacheLayout.insertNewSegment(untag);
+
+				cacheLayout.layoutChanged();
 			}
 		}
 		else
@@ -348,6 +387,8 @@ struct VirtualMemory
 				tmpSegment.willUntag = false;
 			}
 		}
+
+		cacheLayout.layoutChanged();
 	}
 
 	struct LocalMetadata
@@ -38,6 +38,9 @@ __FBSDID("$FreextraBufferSD: src/usr.bin/bsdiff/bsdiff/bsdiff.c,v 1.1 2005/08/06
 #include <cassert>
 #include <climits>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #define BSDIFF_PRIVATE
 
@@ -53,31 +56,92 @@ __FBSDID("$FreextraBufferSD: src/usr.bin/bsdiff/bsdiff/bsdiff.c,v 1.1 2005/08/06
 
 using namespace std;
 
-void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, vector<BSDiffPatch> & patch)
-{
-	auto * index = (off_t*) malloc((oldSize + 1) * sizeof(off_t));
-	auto * value = (off_t*) malloc((oldSize + 1) * sizeof(off_t));
+SuffixSortEngine _suffixSortEngine = SUFFIX_SORT_SAIS;
 
-	if(index == nullptr || value == nullptr)
+template<typename Index>
+static Index * sortSuffixes(const uint8_t * old, size_t oldSize, SuffixSortEngine engine,
+							void (*qsufsortEngine)(Index *, Index *, const uint8_t *, Index), void (*saisEngine)(Index *, const uint8_t *, Index))
+{
+	auto * index = (Index *) malloc((oldSize + 1) * sizeof(Index));
+	if(index == nullptr)
 		err(1, "Malloc error");
-	
+
+	if(engine == SUFFIX_SORT_SAIS)
+	{
+		saisEngine(index, old, (Index) oldSize);
+	}
+	else
+	{
+		auto * value = (Index *) malloc((oldSize + 1) * sizeof(Index));
+		if(value == nullptr)
+			err(1, "Malloc error");
+
+		if(engine == SUFFIX_SORT_PARALLEL)
+			parallelSuffixSort<Index>(index, value, old, (Index) oldSize, _realThreadCount);
+		else
+			qsufsortEngine(index, value, old, (Index) oldSize);
+
+		free(value);
+	}
+
+	return index;
+}
+
+SuffixArray buildSuffixArray(const uint8_t * old, size_t oldSize, SuffixSortEngine engine, bool allowCompact)
+{
 	assert(oldSize <= OFF_MAX);
 
-	qsufsort(index, value, old, (off_t) oldSize);
+	if(allowCompact && oldSize < COMPACT_SUFFIX_INDEX_MAX_SIZE)
+		return SuffixArray {sortSuffixes<int32_t>(old, oldSize, engine, qsufsort32, saisort32), true};
+
+	return SuffixArray {sortSuffixes<off_t>(old, oldSize, engine, qsufsort, saisort), false};
+}
+
+void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, vector<BSDiffPatch> & patch, PatchArena & deltaArena)
+{
+	SuffixArray index = buildSuffixArray(old, oldSize, _suffixSortEngine);
+
+	bsdiff(old, oldSize, newer, newSize, index, vector<MatchedRange>(), patch, deltaArena);
+
+	free(index.index);
+}
+
+void findUntouchedPages(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, vector<MatchedRange> & untouched)
+{
+	//Only full pages present in both images can be left alone
+	const size_t comparableLength = min(oldSize, newSize) & BLOCK_MASK;
 
-	free(value);
+	untouched.clear();
+	for(size_t page = 0; page < comparableLength; page += BLOCK_SIZE)
+	{
+		if(memcmp(&old[page], &newer[page], BLOCK_SIZE) != 0)
+			continue;
 
-	size_t scan = 0, lastScan = 0;
+		if(!untouched.empty() && untouched.back().start + untouched.back().length == page)
+			untouched.back().length += BLOCK_SIZE;
+		else
+			untouched.push_back({page, BLOCK_SIZE, page, true});
+	}
+}
+
+//Diff the section [regionStart; regionEnd[ of new, which we expect to follow old from oldStart
+//	Matches are still looked for in the full new image, only the output is bounded by the region.
+//	Truncating the matches would make us rescan long runs crossing the end of the region byte per byte.
+template<typename Index>
+static void bsdiffRegion(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, size_t regionStart, size_t regionEnd, size_t oldStart, const Index * index, vector<BSDiffPatch> & patch, PatchArena & deltaArena)
+{
+	//The offset wraps around if old is behind, like in the main loop
+	size_t scan = regionStart, lastScan = regionStart;
 	size_t matchPos = 0, matchLength = 0;
-	size_t lastPos = 0, lastOffset = 0;
+	size_t lastPos = oldStart, lastOffset = oldStart - regionStart;
 
-	while (scan < newSize)
+	while (scan < regionEnd)
 	{
 		size_t matchingBytes = 0;
-		scan += matchLength;
+		scan = min(scan + matchLength, regionEnd);
 
 		//Look for the longest matching pattern in old matching a slowly moving window in new
-		for (size_t originalScanPos = scan; scan < newSize; scan++)
+		for (size_t originalScanPos = scan; scan < regionEnd; scan++)
 		{
 			//Look for a matching byte sequence
 			matchLength = search(index, old, oldSize, &newer[scan], newSize - scan, 0, oldSize, &matchPos);
@@ -99,7 +163,7 @@ void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t n
 		}
 
 		//Is there a change or are we at the end of the new file (in which case we need to write the last data)
-		if (matchingBytes != matchLength || scan == newSize)
+		if (matchingBytes != matchLength || scan == regionEnd)
 		{
 			size_t deltaLengthForward = 0;
 
@@ -112,8 +176,8 @@ void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t n
 
 				i += 1;
 
-				//Magic ratio? 2 good bytes for one to patch
-				if (strike * 2 - i > strikeMax * 2 - deltaLengthForward)
+				//Magic ratio? 2 good bytes for one to patch (signed, the first bytes may not match)
+				if ((off_t) (strike * 2) - (off_t) i > (off_t) (strikeMax * 2) - (off_t) deltaLengthForward)
 				{
 					strikeMax = strike;
 					deltaLengthForward = i;
@@ -122,7 +186,7 @@ void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t n
 
 			//Are we actually diffing and not just concatenating?
 			size_t deltaLengthBackward = 0;
-			if (scan < newSize)
+			if (scan < regionEnd)
 			{
 				//Read data backward from the match found by search()
 				for (size_t i = 1, strike = 0, strikeMax = 0; lastScan + i <= scan && i <= matchPos; i++)
@@ -178,10 +242,7 @@ void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t n
 			//Delta computation
 			if(deltaLengthForward)
 			{
-				deltaBuffer = (uint8_t *) malloc(deltaLengthForward);
-
-				if (deltaBuffer == nullptr)
-					errx(1, "Memory error allocatating delta buffer of size (%li)", deltaLengthForward);
+				deltaBuffer = deltaArena.allocate(deltaLengthForward);
 
 				//Build the delta
 				for (size_t i = 0; i < deltaLengthForward; i++)
@@ -196,73 +257,167 @@ void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t n
 			lastOffset = matchPos - scan;
 		}
 	}
+}
 
-	// Free the memory we used
-	free(index);
+struct DiffRegion
+{
+	size_t start;
+	size_t end;
+	size_t oldStart;
+
+	//Either scanned by bsdiff, or copied to the output from a matched range
+	const MatchedRange * matched;
+};
+
+//Cut [start; end[ in regions of at most regionSize bytes. Only the first one knows where it sits in old
+static void addScanRegions(vector<DiffRegion> & regions, size_t start, size_t end, size_t oldStart, size_t regionSize)
+{
+	while(start < end)
+	{
+		const size_t regionEnd = start + min(regionSize, end - start);
+		regions.push_back({start, regionEnd, oldStart, nullptr});
+		start = oldStart = regionEnd;
+	}
 }
 
-void bsdiff(const char * oldFile, const char * newFile, vector<BSDiffPatch> & patch)
+template<typename Index>
+static void bsdiffWithIndex(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, const Index * index, const vector<MatchedRange> & matched, vector<BSDiffPatch> & patch, PatchArena & deltaArena)
 {
-	size_t oldSize;
-	uint8_t *old = readFile(oldFile, &oldSize);
+	//The region size doesn't depend on the number of threads, so that the patch is the same on any machine
+	const size_t regionSize = _realThreadCount <= 1 ? SIZE_MAX : (PARALLEL_SCAN_REGION_SIZE + BLOCK_OFFSET_MASK) & BLOCK_MASK;
+
+	//Regions are page aligned (new starts on a page boundary) and processed independently against the shared index
+	//	Matched ranges are never scanned, they're only copied to the output as a single patch
+	vector<DiffRegion> regions;
+	size_t currentPosition = 0, currentOldPosition = 0;
+	for(const auto & range : matched)
+	{
+		addScanRegions(regions, currentPosition, range.start, currentOldPosition, regionSize);
+		regions.push_back({range.start, range.start + range.length, range.oldStart, &range});
+		currentPosition = range.start + range.length;
+		currentOldPosition = range.oldStart + range.length;
+	}
+	addScanRegions(regions, currentPosition, newSize, currentOldPosition, regionSize);
 
-	size_t newSize;
-	uint8_t *newer = readFile(newFile, &newSize);
+	//Each region has its own arena so that the workers don't have to share an allocator
+	vector<vector<BSDiffPatch>> regionPatches(regions.size());
+	vector<PatchArena> regionArenas(regions.size());
+	atomic<size_t> nextRegion(0);
 
-	bsdiff(old, oldSize, newer, newSize, patch);
+	const FlashGeometry geometry = FlashGeometry::current();
+	auto worker = [&]()
+	{
+		FlashGeometryScope geometryScope(geometry);
 
-	free(old);
-	free(newer);
+		for(size_t region = nextRegion++; region < regions.size(); region = nextRegion++)
+		{
+			const DiffRegion & current = regions[region];
+			const size_t length = current.end - current.start;
+
+			if(current.matched == nullptr)
+			{
+				bsdiffRegion(old, oldSize, newer, newSize, current.start, current.end, current.oldStart, index, regionPatches[region], regionArenas[region]);
+			}
+			else if(current.matched->untouched)
+			{
+				regionPatches[region].emplace_back(BSDiffPatch(current.oldStart, length, nullptr, 0, current.end, true));
+			}
+			else
+			{
+				uint8_t * deltaBuffer = regionArenas[region].allocate(length);
+
+				for(size_t i = 0; i < length; i++)
+					deltaBuffer[i] = newer[current.start + i] - old[current.oldStart + i];
+
+				regionPatches[region].emplace_back(BSDiffPatch(current.oldStart, length, deltaBuffer, 0, current.end));
+			}
+		}
+	};
+
+	if(_realThreadCount <= 1 || regions.size() <= 1)
+	{
+		worker();
+	}
+	else
+	{
+		vector<thread> threads;
+		for(size_t i = 0; i < min(_realThreadCount, regions.size()); ++i)
+			threads.emplace_back(worker);
+
+		for(auto & thread : threads)
+			thread.join();
+	}
+
+	//Each region covers a contiguous section of new, we simply have to concatenate them
+	for(size_t region = 0; region < regions.size(); ++region)
+	{
+		patch.insert(patch.end(), regionPatches[region].begin(), regionPatches[region].end());
+		deltaArena.adopt(regionArenas[region]);
+	}
+}
+
+void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, const SuffixArray & index, const vector<MatchedRange> & matched, vector<BSDiffPatch> & patch, PatchArena & deltaArena)
+{
+	if(index.isCompact)
+		bsdiffWithIndex(old, oldSize, newer, newSize, (const int32_t *) index.index, matched, patch, deltaArena);
+	else
+		bsdiffWithIndex(old, oldSize, newer, newSize, (const off_t *) index.index, matched, patch, deltaArena);
+}
+
+void bsdiff(const char * oldFile, const char * newFile, vector<BSDiffPatch> & patch, PatchArena & deltaArena)
+{
+	ImageFile old, newer;
+
+	if(!old.open(oldFile) || !newer.open(newFile))
+		errx(1, "Couldn't read the images to diff (%s / %s)", oldFile, newFile);
+
+	bsdiff(old.data, old.length, newer.data, newer.length, patch, deltaArena);
 }
 
 void SchedulerPatch::compactBSDiff()
 {
 	if(bsdiff.size() < 2)
 		return;
-	
-	std::vector<BSDiff> newBSDiff;
-	newBSDiff.reserve(bsdiff.size());
-	newBSDiff.emplace_back(bsdiff.front());
 
-	for(auto bsdiffIter = bsdiff.cbegin() + 1; bsdiffIter != bsdiff.cend(); ++bsdiffIter)
+	//generatePatch lays the segments out back to back in the arena, so merging them only means extending the lengths
+	size_t last = 0;
+	for(size_t current = 1; current < bsdiff.size(); ++current)
 	{
+		BSDiff & previous = bsdiff[last];
+		const BSDiff & next = bsdiff[current];
+
+		//Segments going over untouched pages can't be merged with the previous one
+		if(next.skip != 0)
+		{
+			bsdiff[++last] = next;
+		}
 		//We can extend the BSDiff
-		if(newBSDiff.back().extra.length == 0)
+		else if(previous.extra.length == 0)
 		{
-			newBSDiff.back().extra = bsdiffIter->extra;
-
-			const size_t nextDeltaLength = bsdiffIter->delta.length;
-			auto & deltaSegment = newBSDiff.back().delta;
-
-			deltaSegment.data = (uint8_t* ) realloc(deltaSegment.data, deltaSegment.length + nextDeltaLength);
-			memcpy(&deltaSegment.data[deltaSegment.length], bsdiffIter->delta.data, nextDeltaLength);
-			free(bsdiffIter->delta.data);
-			deltaSegment.length += nextDeltaLength;
+			assert(previous.delta.data + previous.delta.length == next.delta.data);
+			previous.delta.length += next.delta.length;
+			previous.extra = next.extra;
 		}
-		else if(bsdiffIter->delta.length == 0)
+		else if(next.delta.length == 0)
 		{
-			const size_t nextExtraLength = bsdiffIter->extra.length;
-			auto & extraSegment = newBSDiff.back().extra;
-
-			extraSegment.data = (uint8_t* ) realloc(extraSegment.data, extraSegment.length + nextExtraLength);
-			memcpy(&extraSegment.data[extraSegment.length], bsdiffIter->extra.data, nextExtraLength);
-			free(bsdiffIter->extra.data);
-			extraSegment.length += nextExtraLength;
+			assert(previous.extra.data + previous.extra.length == next.extra.data);
+			previous.extra.length += next.extra.length;
 		}
 		else
 		{
-			newBSDiff.emplace_back(*bsdiffIter);
+			bsdiff[++last] = next;
 		}
 	}
-	
-	bsdiff = newBSDiff;
+
+	bsdiff.resize(last + 1);
 }
 
 bool writeBSDiff(const SchedulerPatch & patch, void * output)
 {
 	size_t length;
 	uint8_t * encodedCommands = nullptr;
-	Encoder encoder;
+	FlashGeometryScope geometryScope(patch.geometry);
+	Encoder encoder(patch.geometry, patch.format);
 	encoder.encode(patch.commands, encodedCommands, length);
 
 	if(encodedCommands == nullptr)
@@ -288,10 +443,15 @@ bool writeBSDiff(const SchedulerPatch & patch, void * output)
 
 	for(const auto & command : patch.bsdiff)
 	{
-		assert(command.delta.length > 0 && command.delta.length < UINT32_MAX);
+		//An empty delta is reserved to flag a skip, unless one was just performed
+		assert((command.delta.length > 0 || command.skip > 0) && command.delta.length < UINT32_MAX);
 		assert(command.extra.length < UINT32_MAX);
+		assert((command.skip & BLOCK_OFFSET_MASK) == 0 && (command.skip >> BLOCK_SIZE_BIT) < UINT32_MAX);
 
 		fullUncompressedLength += 2 * sizeof(uint32_t) + command.delta.length + command.extra.length;
+
+		if(command.skip)
+			fullUncompressedLength += 2 * sizeof(uint32_t);
 	}
 
 	//Add the space necessary for validation
@@ -309,6 +469,16 @@ bool writeBSDiff(const SchedulerPatch & patch, void * output)
 	size_t index = sizeof(uint32_t);
 	for(const auto & command : patch.bsdiff)
 	{
+		//Skip: an empty delta followed by the number of pages to go over, then the actual segment
+		if(command.skip)
+		{
+			offtout(0, &uncompressedBuffer[index]);
+			index += sizeof(uint32_t);
+
+			offtout(static_cast<uint32_t>(command.skip >> BLOCK_SIZE_BIT), &uncompressedBuffer[index]);
+			index += sizeof(uint32_t);
+		}
+
 		offtout(static_cast<uint32_t>(command.delta.length), &uncompressedBuffer[index]);
 		index += sizeof(uint32_t);
 
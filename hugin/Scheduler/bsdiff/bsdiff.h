@@ -17,12 +17,77 @@
 extern "C"
 {
 	void qsufsort(off_t *index, off_t *value, const uint8_t *old, off_t oldSize);
-	size_t search(off_t *index, const uint8_t *old, size_t oldSize, const uint8_t *newer, size_t newSize, size_t st, size_t en, size_t *matchPos);
+	void saisort(off_t *index, const uint8_t *old, off_t oldSize);
+	size_t search(const off_t *index, const uint8_t *old, size_t oldSize, const uint8_t *newer, size_t newSize, size_t st, size_t en, size_t *matchPos);
+
+	//Compact (32 bits) variants
+	void qsufsort32(int32_t *index, int32_t *value, const uint8_t *old, int32_t oldSize);
+	void saisort32(int32_t *index, const uint8_t *old, int32_t oldSize);
+	size_t search32(const int32_t *index, const uint8_t *old, size_t oldSize, const uint8_t *newer, size_t newSize, size_t st, size_t en, size_t *matchPos);
+
 	void offtout(uint32_t x, uint8_t *buf);
 }
+
+static inline size_t search(const int32_t *index, const uint8_t *old, size_t oldSize, const uint8_t *newer, size_t newSize, size_t st, size_t en, size_t *matchPos)
+{
+	return search32(index, old, oldSize, newer, newSize, st, en, matchPos);
+}
+
+template<typename Index>
+void parallelSuffixSort(Index *index, Index *value, const uint8_t *old, Index oldSize, size_t threadCount);
 #endif
 
-extern "C" uint8_t * readFile(const char * file, size_t * fileSize);
+extern "C"
+{
+	uint8_t * readFile(const char * file, size_t * fileSize);
+	uint8_t * readFileDescriptor(int fd, const char * file, size_t * fileSize);
+}
+
+//Read-only image, mapped when the file allows it and read in a buffer otherwise (pipes...)
+struct ImageFile
+{
+	const uint8_t * data;
+	size_t length;
+
+	//0 if data was read in a malloc'd buffer
+	size_t mappingLength;
+
+	ImageFile() : data(nullptr), length(0), mappingLength(0) {}
+	ImageFile(const ImageFile &) = delete;
+	ImageFile & operator=(const ImageFile &) = delete;
+	~ImageFile()	{	release();	}
+
+	bool open(const char * file);
+	void release();
+};
+
+enum SuffixSortEngine
+{
+	SUFFIX_SORT_QSUFSORT,
+	SUFFIX_SORT_SAIS,
+	SUFFIX_SORT_PARALLEL
+};
+
+//Engine used by bsdiff to sort the suffixes of the original image. They all produce the same index
+extern SuffixSortEngine _suffixSortEngine;
+
+//Images smaller than this use 32 bits indexes, which halves the memory used by the sorting
+//	The sorting algorithms need a signed index, and room for twice the size of the image
+#define COMPACT_SUFFIX_INDEX_MAX_SIZE	(1u << 30u)
+
+struct SuffixArray
+{
+	//int32_t * if isCompact, off_t * otherwise. Always oldSize + 1 entries
+	void * index;
+	bool isCompact;
+
+	size_t entryWidth() const	{	return isCompact ? sizeof(int32_t) : sizeof(off_t);	}
+};
+
+SuffixArray buildSuffixArray(const uint8_t * old, size_t oldSize, SuffixSortEngine engine, bool allowCompact = true);
+
+//Directory where the suffix arrays of the original images are cached between runs, nullptr to disable
+extern const char * _suffixArrayCacheDir;
 
 #ifdef RAVENS_PUBLIC_COMMAND_H
 
@@ -35,12 +100,35 @@ extern "C" uint8_t * readFile(const char * file, size_t * fileSize);
 		uint8_t *deltaData;
 		size_t extraPos;
 
-		BSDiffPatch(const size_t & oldDataAddress, const size_t & lengthDelta, uint8_t *deltaData, const size_t & lengthExtra, const size_t extraPos)
-				: oldDataAddress(oldDataAddress), lengthDelta(lengthDelta), lengthExtra(lengthExtra), deltaData(deltaData), extraPos(extraPos) {}
+		//Run of pages identical in old and new. lengthDelta covers the run but there is no deltaData, the pages won't be rewritten
+		bool untouched;
+
+		BSDiffPatch(const size_t & oldDataAddress, const size_t & lengthDelta, uint8_t *deltaData, const size_t & lengthExtra, const size_t extraPos, bool untouched = false)
+				: oldDataAddress(oldDataAddress), lengthDelta(lengthDelta), lengthExtra(lengthExtra), deltaData(deltaData), extraPos(extraPos), untouched(untouched) {}
 	};
 
-	void bsdiff(const char * oldFile, const char * newFile, std::vector<BSDiffPatch> & patch);
-	void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, std::vector<BSDiffPatch> & patch);
+	//Section of new found in old before the bsdiff scan, which won't be searched
+	struct MatchedRange
+	{
+		size_t start;
+		size_t length;
+		size_t oldStart;
+
+		//Pages with the same content at the same address in old and new
+		bool untouched;
+	};
+
+	//Detect the runs of new shifted from old, and insert them in the gaps between the existing ranges
+	extern bool _detectShiftedRuns;
+
+	void findUntouchedPages(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, std::vector<MatchedRange> & untouched);
+	void findShiftedRuns(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, std::vector<MatchedRange> & ranges);
+
+	//The delta buffers of the patches are allocated in deltaArena, which must outlive them
+	void bsdiff(const char * oldFile, const char * newFile, std::vector<BSDiffPatch> & patch, PatchArena & deltaArena);
+	void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, std::vector<BSDiffPatch> & patch, PatchArena & deltaArena);
+	void bsdiff(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, const SuffixArray & index, const std::vector<MatchedRange> & matched, std::vector<BSDiffPatch> & patch, PatchArena & deltaArena);
+	void bsdiffWithCache(const uint8_t * old, size_t oldSize, size_t skip, const uint8_t * newer, size_t newSize, const std::vector<MatchedRange> & matched, std::vector<BSDiffPatch> & patch, PatchArena & deltaArena);
 	bool writeBSDiff(const SchedulerPatch & patch, void * output);
 
 	bool validateBSDiff(const uint8_t * original, size_t originalLength, const uint8_t * newer, size_t newLength, const std::vector<BSDiffPatch> & patch, size_t earlySkip);
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "bsdiff.h"
+
+bool ImageFile::open(const char * file)
+{
+	release();
+
+	int fd = ::open(file, O_RDONLY, 0);
+	if(fd < 0)
+		return false;
+
+	//Regular files are mapped, the kernel will only load the pages we actually read and share them between runs
+	struct stat info = {};
+	if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+	{
+		void * mapping = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(mapping != MAP_FAILED)
+		{
+			data = (const uint8_t *) mapping;
+			length = mappingLength = (size_t) info.st_size;
+		}
+	}
+
+	//Pipes, empty files or a failed mapping: we read the file instead
+	if(data == nullptr)
+		data = readFileDescriptor(fd, file, &length);
+
+	close(fd);
+	return data != nullptr;
+}
+
+void ImageFile::release()
+{
+	if(mappingLength != 0)
+		munmap((void *) data, mappingLength);
+	else
+		free((void *) data);
+
+	data = nullptr;
+	length = 0;
+	mappingLength = 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <err.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+#define BSDIFF_PRIVATE
+#include "bsdiff.h"
+
+using namespace std;
+
+/*
+ * Parallel prefix doubling.
+ *
+ * Same contract as qsufsort: index receives the suffix array (empty suffix first) and value its inverse.
+ * Unlike qsufsort, ranks are frozen during each round: groups are sorted concurrently against the ranks of
+ * the previous round, then the new ranks are published. Each group is independent, so the work is split
+ * between threads with a barrier between both phases, and the output doesn't depend on the scheduling.
+ */
+
+//Positions are stored as off_t whatever the width of the index, groups are few enough for this not to matter
+struct SuffixGroup
+{
+	off_t start;
+	off_t length;
+};
+
+//Split the groups between the threads, trying to give each of them the same number of suffixes
+template<typename Worker>
+static void dispatchGroups(const vector<SuffixGroup> & groups, size_t threadCount, const Worker & worker)
+{
+	if(threadCount <= 1 || groups.size() <= 1)
+	{
+		worker(0, groups.size(), 0);
+		return;
+	}
+
+	off_t totalLength = 0;
+	for(const auto & group : groups)
+		totalLength += group.length;
+
+	vector<thread> threads;
+	threads.reserve(threadCount);
+
+	size_t currentGroup = 0;
+	off_t dispatchedLength = 0;
+	for(size_t threadID = 0; threadID < threadCount && currentGroup < groups.size(); ++threadID)
+	{
+		const off_t target = totalLength * (off_t) (threadID + 1) / (off_t) threadCount;
+		const size_t firstGroup = currentGroup;
+
+		while(currentGroup < groups.size() && (dispatchedLength < target || currentGroup == firstGroup))
+			dispatchedLength += groups[currentGroup++].length;
+
+		threads.emplace_back(worker, firstGroup, currentGroup, threadID);
+	}
+
+	for(auto & thread : threads)
+		thread.join();
+}
+
+template<typename Index>
+void parallelSuffixSort(Index *index, Index *value, const uint8_t *old, Index oldSize, size_t threadCount)
+{
+	const Index length = oldSize + 1;
+
+	//Bucket the suffixes by their two first bytes, the sentinel being smaller than any byte
+	auto initialKey = [old, oldSize](Index i) -> size_t
+	{
+		if(i == oldSize)
+			return 0;
+
+		return (old[i] + 1u) * 257u + (i + 1 < oldSize ? old[i + 1] + 1u : 0u);
+	};
+
+	vector<Index> buckets(257 * 257 + 1, 0);
+	for(Index i = 0; i < length; i++)
+		buckets[initialKey(i) + 1] += 1;
+
+	for(size_t i = 1; i < buckets.size(); i++)
+		buckets[i] += buckets[i - 1];
+
+	for(Index i = 0; i < length; i++)
+		index[buckets[initialKey(i)]++] = i;
+
+	//The rank of a suffix is the last position of its group, like qsufsort
+	vector<SuffixGroup> groups;
+	for(Index start = 0, end; start < length; start = end)
+	{
+		const size_t key = initialKey(index[start]);
+		for(end = start + 1; end < length && initialKey(index[end]) == key; ++end);
+
+		for(Index i = start; i < end; i++)
+			value[index[i]] = end - 1;
+
+		if(end - start > 1)
+			groups.push_back({start, end - start});
+	}
+
+	if(groups.empty())
+		return;
+
+	auto * newRank = (Index *) malloc((size_t) length * sizeof(Index));
+	if(newRank == nullptr)
+		err(1, "Malloc error");
+
+	vector<vector<SuffixGroup>> nextGroups(threadCount > 1 ? threadCount : 1);
+
+	//Suffixes shorter than h always have a unique rank, so index[i] + h never goes past the sentinel
+	for(Index h = 2; !groups.empty(); h *= 2)
+	{
+		//Sort each group against the ranks of the previous round
+		dispatchGroups(groups, threadCount, [&](size_t first, size_t last, size_t threadID)
+		{
+			auto & splitGroups = nextGroups[threadID];
+
+			for(size_t groupID = first; groupID < last; ++groupID)
+			{
+				const SuffixGroup & group = groups[groupID];
+				Index * base = &index[group.start];
+
+				sort(base, base + group.length, [value, h](const Index & a, const Index & b) { return value[a + h] < value[b + h]; });
+
+				for(Index start = 0, end; start < group.length; start = end)
+				{
+					const Index key = value[base[start] + h];
+					for(end = start + 1; end < group.length && value[base[end] + h] == key; ++end);
+
+					for(Index i = start; i < end; i++)
+						newRank[group.start + i] = group.start + end - 1;
+
+					if(end - start > 1)
+						splitGroups.push_back({group.start + start, end - start});
+				}
+			}
+		});
+
+		//Publish the new ranks
+		dispatchGroups(groups, threadCount, [&](size_t first, size_t last, size_t)
+		{
+			for(size_t groupID = first; groupID < last; ++groupID)
+			{
+				for(Index i = groups[groupID].start, end = i + groups[groupID].length; i < end; i++)
+					value[index[i]] = newRank[i];
+			}
+		});
+
+		groups.clear();
+		for(auto & splitGroups : nextGroups)
+		{
+			groups.insert(groups.end(), splitGroups.begin(), splitGroups.end());
+			splitGroups.clear();
+		}
+	}
+
+	free(newRank);
+}
+
+template void parallelSuffixSort<off_t>(off_t *index, off_t *value, const uint8_t *old, off_t oldSize, size_t threadCount);
+template void parallelSuffixSort<int32_t>(int32_t *index, int32_t *value, const uint8_t *old, int32_t oldSize, size_t threadCount);
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+/*
+ * qsufsort and search, for one width of suffix index.
+ * Included by bsdiff_utils.c with SA_INDEX (signed index type) and SA_NAME (function name decoration) defined.
+ */
+
+static inline void SA_NAME(swap)(SA_INDEX * array, SA_INDEX index1, SA_INDEX  index2)
+{
+	SA_INDEX tmp = array[index1];
+	array[index1] = array[index2];
+	array[index2] = tmp;
+}
+
+static void SA_NAME(split)(SA_INDEX *index, SA_INDEX *value, SA_INDEX start, SA_INDEX matchLength, SA_INDEX offset)
+{
+	if (matchLength < 16)
+	{
+		//Bubble sort
+		for (SA_INDEX k = start, lastStrike; k < start + matchLength; k += lastStrike)
+		{
+			lastStrike = 1;
+			SA_INDEX x = value[index[k] + offset];
+
+			for (SA_INDEX i = k + 1; i < start + matchLength; i++)
+			{
+				//Is minimum?
+				if (value[index[i] + offset] < x)
+				{
+					x = value[index[i] + offset];
+					lastStrike = 0;
+				}
+
+				//Found multiple hits with the same value, we move them just after the original minimum
+				if (value[index[i] + offset] == x)
+				{
+					SA_NAME(swap)(index, k + lastStrike, i);
+					lastStrike += 1;
+				}
+			}
+
+			for (SA_INDEX i = 0; i < lastStrike; i++)
+				value[index[k + i]] = k + lastStrike - 1;
+
+			if (lastStrike == 1)
+				index[k] = -1;
+		}
+	}
+	else
+	{
+		SA_INDEX pivotValue = value[index[start + matchLength / 2] + offset];
+		SA_INDEX nbBelowPivotValue = 0, nbBelowOrEqualToPivotValue = 0;
+
+		//Count items below our insertion pivot
+		for (SA_INDEX i = start; i < start + matchLength; i++)
+		{
+			if (value[index[i] + offset] < pivotValue)
+				nbBelowPivotValue++;
+
+			if (value[index[i] + offset] == pivotValue)
+				nbBelowOrEqualToPivotValue++;
+		}
+
+		//Compute the number of value that will have to be moved before the final pivot position
+		nbBelowPivotValue += start;
+		nbBelowOrEqualToPivotValue += nbBelowPivotValue;
+
+		SA_INDEX equalValueCount = 0, higherValueCount = 0;
+
+		//Move items <= to the pivot value in the first part of the array
+		//	Each half are still unsorted
+		for (SA_INDEX i = start; i < nbBelowPivotValue;)
+		{
+			//Item below the pivot is less than pivot. Perfect
+			if (value[index[i] + offset] < pivotValue)
+			{
+				i++;
+			}
+				//Item has the same value than pivot, we move it just after the pivot
+			else if (value[index[i] + offset] == pivotValue)
+			{
+				SA_NAME(swap)(index, i, nbBelowPivotValue + equalValueCount);
+				equalValueCount++;
+			}
+				//Item has a higher value than pivot, we move it after the pivot and the space allocated to it
+			else
+			{
+				SA_NAME(swap)(index, i, nbBelowOrEqualToPivotValue + higherValueCount);
+				higherValueCount++;
+			}
+		}
+
+		//We found all values that belonged before the pivot but are still missing some that are equal to the pivot
+		while (nbBelowPivotValue + equalValueCount < nbBelowOrEqualToPivotValue)
+		{
+			if (value[index[nbBelowPivotValue + equalValueCount] + offset] == pivotValue)
+			{
+				equalValueCount++;
+			}
+			else
+			{
+				SA_NAME(swap)(index, nbBelowPivotValue + equalValueCount, nbBelowOrEqualToPivotValue + higherValueCount);
+				higherValueCount++;
+			}
+		}
+
+		//If we had values < to pivot
+		if (nbBelowPivotValue > start)
+			SA_NAME(split)(index, value, start, nbBelowPivotValue - start, offset);
+
+		//Mark all values equal to pivot
+		for (SA_INDEX i = 0; i < nbBelowOrEqualToPivotValue - nbBelowPivotValue; i++)
+			value[index[nbBelowPivotValue + i]] = nbBelowOrEqualToPivotValue - 1;
+
+		//If only one occurence of the pivot, we update the index
+		if (nbBelowPivotValue == nbBelowOrEqualToPivotValue - 1)
+			index[nbBelowPivotValue] = -1;
+
+		//Had values after the pivot
+		if (start + matchLength > nbBelowOrEqualToPivotValue)
+			SA_NAME(split)(index, value, nbBelowOrEqualToPivotValue, start + matchLength - nbBelowOrEqualToPivotValue, offset);
+	}
+}
+
+void SA_NAME(qsufsort)(SA_INDEX *index, SA_INDEX *value, const uint8_t *old, SA_INDEX oldSize)
+{
+	SA_INDEX buckets[256];
+
+	//Count the number of hit in each bucket, sum them upward (each bucket has the number of hit in bucket <= to it, then drop the last one)
+	memset(buckets, 0, sizeof(buckets));
+
+	for (SA_INDEX i = 0; i < oldSize; i++)
+		buckets[old[i]] += 1;
+
+	for (size_t i = 1; i < 256; i++)
+		buckets[i] += buckets[i - 1];
+
+	//We drop the last bucket (the sum of all values)
+	for (size_t i = 255; i > 0; i--)
+		buckets[i] = buckets[i - 1];
+
+	buckets[0] = 0;
+
+	//Write to index the sorted rank of each value in old
+	// 	(buckets[old[i]] is the number of time the value old[i] as been met + the base offset of the value, i.e. the number of occurences of values < itself)
+	for (SA_INDEX i = 0; i < oldSize; i++)
+		index[++buckets[old[i]]] = i;
+
+	//Write to `value` the number of bytes <= to old[i]
+	for (SA_INDEX i = 0; i < oldSize; i++)
+		value[i] = buckets[old[i]];
+	value[oldSize] = 0;
+
+	//Find all byte value for which only one match was found, and write that to index
+	for (SA_INDEX i = 1; i < 256; i++)
+	{
+		if (buckets[i] == buckets[i - 1] + 1)
+			index[buckets[i]] = -1;
+	}
+
+	//Encode strike length
+	index[0] = -1;
+
+	for (SA_INDEX h = 1; index[0] != -(oldSize + 1); h *= 2)
+	{
+		SA_INDEX matchLength = 0, i = 0;
+		while (i < oldSize + 1)
+		{
+			//If the previous strike end up on another strike, extend the previous one
+			if (index[i] < 0)
+			{
+				matchLength -= index[i];
+				i -= index[i];
+			}
+			else
+			{
+				//Mark the real length of the strike
+				if (matchLength)
+					index[i - matchLength] = -matchLength;
+
+				//???????
+				matchLength = value[index[i]] + 1 - i;
+
+				//Sort index so that value[index[i]] <= value[index[i + 1]] from i + h and for length matchLength
+				//	Suffixes shorter than h already have a unique rank, so index[k] + h never goes past the sentinel
+				SA_NAME(split)(index, value, i, matchLength, h);
+
+				i += matchLength;
+				matchLength = 0;
+			}
+		}
+
+		if (matchLength)
+			index[i - matchLength] = -matchLength;
+	}
+
+	for (SA_INDEX i = 0; i < oldSize + 1; i++)
+		index[value[i]] = i;
+}
+
+size_t SA_NAME(search)(const SA_INDEX *index, const uint8_t *old, size_t oldSize, const uint8_t *newer, size_t newSize, size_t start, size_t end, size_t *matchPos)
+{
+	//Length of the prefix shared by newer and the suffixes at both ends of the range
+	//	Every suffix in between shares at least MIN(startLength, endLength) bytes with newer, which we don't need to compare again
+	size_t startLength = matchlen(&old[index[start]], newer, 0, MIN(oldSize - index[start], newSize));
+	size_t endLength = matchlen(&old[index[end]], newer, 0, MIN(oldSize - index[end], newSize));
+
+	while (end - start >= 2)
+	{
+		const size_t x = start + (end - start) / 2;
+		const size_t suffixLength = oldSize - index[x];
+		const size_t compareLength = MIN(suffixLength, newSize);
+		const size_t matchLength = matchlen(&old[index[x]], newer, MIN(startLength, endLength), compareLength);
+
+		//Is the suffix smaller than newer?
+		if (matchLength < compareLength && old[index[x] + matchLength] < newer[matchLength])
+		{
+			start = x;
+			startLength = matchLength;
+		}
+		else
+		{
+			end = x;
+			endLength = matchLength;
+		}
+	}
+
+	if (startLength > endLength)
+	{
+		*matchPos = (size_t) index[start];
+		return startLength;
+	}
+	else
+	{
+		*matchPos = (size_t) index[end];
+		return endLength;
+	}
+}
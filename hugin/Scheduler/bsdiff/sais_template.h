@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+/*
+ * SA-IS, for one width of suffix index.
+ * Included by suffix_sort.c with SA_INDEX (signed index type) and SA_NAME (function name decoration) defined.
+ */
+
+typedef struct
+{
+	//Level 0 is the firmware image (+ the virtual sentinel), deeper levels are the reduced strings
+	const uint8_t * bytes;
+	const SA_INDEX * symbols;
+
+	//Length including the sentinel
+	SA_INDEX length;
+	SA_INDEX alphabetSize;
+
+	//Bitmap, 1 if the suffix is S-type
+	uint8_t * types;
+
+} SA_NAME(SAISString);
+
+static inline SA_INDEX SA_NAME(symbolAt)(const SA_NAME(SAISString) * string, SA_INDEX i)
+{
+	if(string->symbols != NULL)
+		return string->symbols[i];
+
+	//Bytes are shifted by one in order to make room for the sentinel
+	return i == string->length - 1 ? 0 : (SA_INDEX) string->bytes[i] + 1;
+}
+
+static inline bool SA_NAME(isSType)(const SA_NAME(SAISString) * string, SA_INDEX i)
+{
+	return (string->types[i >> 3] >> (i & 7)) & 1;
+}
+
+static inline void SA_NAME(setType)(SA_NAME(SAISString) * string, SA_INDEX i, bool isS)
+{
+	if(isS)
+		string->types[i >> 3] |= 1u << (i & 7);
+	else
+		string->types[i >> 3] &= ~(1u << (i & 7));
+}
+
+static inline bool SA_NAME(isLMS)(const SA_NAME(SAISString) * string, SA_INDEX i)
+{
+	return i > 0 && SA_NAME(isSType)(string, i) && !SA_NAME(isSType)(string, i - 1);
+}
+
+static void SA_NAME(getBuckets)(const SA_NAME(SAISString) * string, SA_INDEX * buckets, bool end)
+{
+	memset(buckets, 0, (size_t) string->alphabetSize * sizeof(SA_INDEX));
+
+	for(SA_INDEX i = 0; i < string->length; i++)
+		buckets[SA_NAME(symbolAt)(string, i)] += 1;
+
+	for(SA_INDEX i = 0, sum = 0; i < string->alphabetSize; i++)
+	{
+		sum += buckets[i];
+		buckets[i] = end ? sum : sum - buckets[i];
+	}
+}
+
+static void SA_NAME(induceSort)(const SA_NAME(SAISString) * string, SA_INDEX * index, SA_INDEX * buckets)
+{
+	//L-type suffixes, from the start of their buckets
+	SA_NAME(getBuckets)(string, buckets, false);
+	for(SA_INDEX i = 0; i < string->length; i++)
+	{
+		SA_INDEX j = index[i] - 1;
+		if(j >= 0 && !SA_NAME(isSType)(string, j))
+			index[buckets[SA_NAME(symbolAt)(string, j)]++] = j;
+	}
+
+	//S-type suffixes, from the end of their buckets
+	SA_NAME(getBuckets)(string, buckets, true);
+	for(SA_INDEX i = string->length - 1; i >= 0; i--)
+	{
+		SA_INDEX j = index[i] - 1;
+		if(j >= 0 && SA_NAME(isSType)(string, j))
+			index[--buckets[SA_NAME(symbolAt)(string, j)]] = j;
+	}
+}
+
+static bool SA_NAME(sameLMSSubstring)(const SA_NAME(SAISString) * string, SA_INDEX first, SA_INDEX second)
+{
+	for(SA_INDEX i = 0; i < string->length; i++)
+	{
+		if(SA_NAME(symbolAt)(string, first + i) != SA_NAME(symbolAt)(string, second + i) || SA_NAME(isSType)(string, first + i) != SA_NAME(isSType)(string, second + i))
+			return false;
+
+		if(i > 0 && (SA_NAME(isLMS)(string, first + i) || SA_NAME(isLMS)(string, second + i)))
+			return true;
+	}
+
+	return true;
+}
+
+static void SA_NAME(sais)(SA_NAME(SAISString) * string, SA_INDEX * index)
+{
+	const SA_INDEX length = string->length;
+
+	string->types = calloc((size_t) (length >> 3) + 1, 1);
+	SA_INDEX * buckets = malloc((size_t) string->alphabetSize * sizeof(SA_INDEX));
+
+	if(string->types == NULL || buckets == NULL)
+		err(1, "Malloc error");
+
+	//Classify the suffixes. The sentinel is S-type and the suffix before it is L-type
+	SA_NAME(setType)(string, length - 1, true);
+	for(SA_INDEX i = length - 3; i >= 0; i--)
+	{
+		const SA_INDEX current = SA_NAME(symbolAt)(string, i), next = SA_NAME(symbolAt)(string, i + 1);
+		SA_NAME(setType)(string, i, current < next || (current == next && SA_NAME(isSType)(string, i + 1)));
+	}
+
+	//Stage 1: sort the LMS substrings
+	SA_NAME(getBuckets)(string, buckets, true);
+	for(SA_INDEX i = 0; i < length; i++)
+		index[i] = -1;
+
+	for(SA_INDEX i = 1; i < length; i++)
+	{
+		if(SA_NAME(isLMS)(string, i))
+			index[--buckets[SA_NAME(symbolAt)(string, i)]] = i;
+	}
+
+	SA_NAME(induceSort)(string, index, buckets);
+
+	//Compact the sorted LMS substrings at the beginning of index
+	SA_INDEX nbLMS = 0;
+	for(SA_INDEX i = 0; i < length; i++)
+	{
+		if(SA_NAME(isLMS)(string, index[i]))
+			index[nbLMS++] = index[i];
+	}
+
+	//Name the LMS substrings. Two LMS can't be closer than 2, so pos / 2 is unique
+	for(SA_INDEX i = nbLMS; i < length; i++)
+		index[i] = -1;
+
+	SA_INDEX name = 0, previous = -1;
+	for(SA_INDEX i = 0; i < nbLMS; i++)
+	{
+		const SA_INDEX position = index[i];
+
+		if(previous == -1 || !SA_NAME(sameLMSSubstring)(string, position, previous))
+		{
+			name += 1;
+			previous = position;
+		}
+
+		index[nbLMS + position / 2] = name - 1;
+	}
+
+	for(SA_INDEX i = length - 1, j = length - 1; i >= nbLMS; i--)
+	{
+		if(index[i] >= 0)
+			index[j--] = index[i];
+	}
+
+	//Stage 2: sort the reduced string, recursively if names aren't unique yet
+	SA_INDEX * reducedIndex = index, * reducedString = index + length - nbLMS;
+
+	if(name < nbLMS)
+	{
+		SA_NAME(SAISString) reduced = {.bytes = NULL, .symbols = reducedString, .length = nbLMS, .alphabetSize = name, .types = NULL};
+		SA_NAME(sais)(&reduced, reducedIndex);
+	}
+	else
+	{
+		for(SA_INDEX i = 0; i < nbLMS; i++)
+			reducedIndex[reducedString[i]] = i;
+	}
+
+	//Stage 3: induce the full suffix array from the sorted LMS suffixes
+	for(SA_INDEX i = 1, j = 0; i < length; i++)
+	{
+		if(SA_NAME(isLMS)(string, i))
+			reducedString[j++] = i;
+	}
+
+	for(SA_INDEX i = 0; i < nbLMS; i++)
+		reducedIndex[i] = reducedString[reducedIndex[i]];
+
+	for(SA_INDEX i = nbLMS; i < length; i++)
+		index[i] = -1;
+
+	SA_NAME(getBuckets)(string, buckets, true);
+	for(SA_INDEX i = nbLMS - 1; i >= 0; i--)
+	{
+		SA_INDEX j = index[i];
+		index[i] = -1;
+		index[--buckets[SA_NAME(symbolAt)(string, j)]] = j;
+	}
+
+	SA_NAME(induceSort)(string, index, buckets);
+
+	free(buckets);
+	free(string->types);
+	string->types = NULL;
+}
+
+void SA_NAME(saisort)(SA_INDEX *index, const uint8_t *old, SA_INDEX oldSize)
+{
+	//Only the empty suffix
+	if(oldSize == 0)
+	{
+		index[0] = 0;
+		return;
+	}
+
+	SA_NAME(SAISString) string = {.bytes = old, .symbols = NULL, .length = oldSize + 1, .alphabetSize = 257, .types = NULL};
+	SA_NAME(sais)(&string, index);
+}
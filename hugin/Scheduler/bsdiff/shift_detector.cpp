@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/types.h>
+
+#define BSDIFF_PRIVATE
+
+#include "../public_command.h"
+#include "bsdiff.h"
+
+using namespace std;
+
+/*
+ * Detection of the sections of new copied verbatim from old, usually at another address when the linker inserted a few bytes.
+ *
+ * old is indexed by blocks of SHIFT_DETECTOR_WINDOW bytes, then a rolling hash of the same width slides over new (rsync style).
+ * Any run at least twice as long as the window contains one of the indexed blocks, so is found in linear time.
+ * The runs are then extended both ways, and kept if longer than SHIFT_DETECTOR_MIN_RUN. bsdiff only scans what is left.
+ */
+
+bool _detectShiftedRuns = false;
+
+//Polynomial hash, the base being the 64 bits FNV prime
+#define ROLLING_HASH_BASE		0x100000001b3ull
+
+//Bits of the hash used by the filter, checked before looking up the index
+#define SHIFT_FILTER_BITS		20u
+
+static uint64_t hashWindow(const uint8_t * data)
+{
+	uint64_t hash = 0;
+
+	for(size_t i = 0; i < SHIFT_DETECTOR_WINDOW; ++i)
+		hash = hash * ROLLING_HASH_BASE + data[i];
+
+	return hash;
+}
+
+struct ShiftDetector
+{
+	const uint8_t * old;
+	size_t oldSize;
+	const uint8_t * newer;
+
+	uint64_t windowBasePower;
+	unordered_map<uint64_t, size_t> blocks;
+	vector<uint64_t> filter;
+
+	ShiftDetector(const uint8_t * old, size_t oldSize, const uint8_t * newer) : old(old), oldSize(oldSize), newer(newer), windowBasePower(1), filter((1u << SHIFT_FILTER_BITS) / 64, 0)
+	{
+		for(size_t i = 1; i < SHIFT_DETECTOR_WINDOW; ++i)
+			windowBasePower *= ROLLING_HASH_BASE;
+
+		//Identical blocks (padding...) keep their first occurrence
+		blocks.reserve(oldSize / SHIFT_DETECTOR_WINDOW);
+		for(size_t position = 0; position + SHIFT_DETECTOR_WINDOW <= oldSize; position += SHIFT_DETECTOR_WINDOW)
+		{
+			const uint64_t hash = hashWindow(&old[position]);
+			const uint64_t filterBit = hash >> (64u - SHIFT_FILTER_BITS);
+
+			blocks.emplace(hash, position);
+			filter[filterBit / 64] |= 1ull << (filterBit % 64);
+		}
+	}
+
+	bool mayContain(uint64_t hash) const
+	{
+		const uint64_t filterBit = hash >> (64u - SHIFT_FILTER_BITS);
+		return (filter[filterBit / 64] & (1ull << (filterBit % 64))) != 0;
+	}
+
+	//Look for runs in [start; end[ of new
+	void scanGap(size_t start, size_t end, vector<MatchedRange> & output) const
+	{
+		if(end - start < SHIFT_DETECTOR_MIN_RUN)
+			return;
+
+		const size_t firstRun = output.size();
+		size_t position = start;
+		uint64_t hash = hashWindow(&newer[position]);
+
+		while(true)
+		{
+			if(mayContain(hash))
+			{
+				const auto & candidate = blocks.find(hash);
+
+				if(candidate != blocks.end() && !memcmp(&old[candidate->second], &newer[position], SHIFT_DETECTOR_WINDOW))
+				{
+					const size_t oldPosition = candidate->second;
+
+					//Extend the run backward, without going over the previous one
+					size_t backward = 0;
+					while(position - backward > start && backward < oldPosition && old[oldPosition - backward - 1] == newer[position - backward - 1])
+						backward += 1;
+
+					size_t forward = SHIFT_DETECTOR_WINDOW;
+					while(position + forward < end && oldPosition + forward < oldSize && old[oldPosition + forward] == newer[position + forward])
+						forward += 1;
+
+					if(backward + forward >= SHIFT_DETECTOR_MIN_RUN)
+					{
+						const size_t runStart = position - backward, runOldStart = oldPosition - backward;
+
+						//Runs shifted by the same amount, separated by a few changes (relocations...) are better handled as a single delta
+						if(output.size() > firstRun && output.back().oldStart - output.back().start == runOldStart - runStart
+						   && runStart - (output.back().start + output.back().length) <= SHIFT_DETECTOR_MAX_GAP)
+							output.back().length = runStart + backward + forward - output.back().start;
+						else
+							output.push_back({runStart, backward + forward, runOldStart, false});
+
+						//We restart the hash after the run
+						start = position += forward;
+						if(end - position < SHIFT_DETECTOR_WINDOW)
+							return;
+
+						hash = hashWindow(&newer[position]);
+						continue;
+					}
+				}
+			}
+
+			if(position + SHIFT_DETECTOR_WINDOW >= end)
+				return;
+
+			hash = (hash - newer[position] * windowBasePower) * ROLLING_HASH_BASE + newer[position + SHIFT_DETECTOR_WINDOW];
+			position += 1;
+		}
+	}
+};
+
+void findShiftedRuns(const uint8_t * old, size_t oldSize, const uint8_t * newer, size_t newSize, vector<MatchedRange> & ranges)
+{
+	if(oldSize < SHIFT_DETECTOR_WINDOW || newSize < SHIFT_DETECTOR_MIN_RUN)
+		return;
+
+	const ShiftDetector detector(old, oldSize, newer);
+	vector<MatchedRange> output;
+	size_t gapStart = 0;
+
+	output.reserve(ranges.size());
+	for(const auto & range : ranges)
+	{
+		detector.scanGap(gapStart, range.start, output);
+		output.push_back(range);
+		gapStart = range.start + range.length;
+	}
+
+	detector.scanGap(gapStart, newSize, output);
+
+	ranges.swap(output);
+}
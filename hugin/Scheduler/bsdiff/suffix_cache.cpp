@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define BSDIFF_PRIVATE
+
+#include "../public_command.h"
+#include "bsdiff.h"
+#include <crypto_utils.h>
+
+using namespace std;
+
+/*
+ * The suffix array of an original image is cached in <cache dir>/<SHA-256 of the image>.sa
+ * The file is a SuffixArrayCacheHeader followed by the oldSize + 1 entries of index, in the host format.
+ * The width of the entries follows buildSuffixArray (compact for small images).
+ * Caches are only meant to be reused on the machine which generated them.
+ */
+
+#define SUFFIX_CACHE_MAGIC		"RAVSAIDX"
+#define SUFFIX_CACHE_VERSION	1u
+
+const char * _suffixArrayCacheDir = nullptr;
+
+struct SuffixArrayCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entryWidth;
+	uint64_t imageLength;
+};
+
+struct CachedSuffixArray
+{
+	SuffixArray index;
+
+	void * mapping;
+	size_t mappingLength;
+
+	CachedSuffixArray() : index({nullptr, false}), mapping(nullptr), mappingLength(0) {}
+
+	bool loadFromFile(const string & path, size_t oldSize)
+	{
+		int fd = open(path.c_str(), O_RDONLY, 0);
+		if(fd < 0)
+			return false;
+
+		const bool isCompact = oldSize < COMPACT_SUFFIX_INDEX_MAX_SIZE;
+		const size_t entryWidth = isCompact ? sizeof(int32_t) : sizeof(off_t);
+
+		struct stat info = {};
+		const size_t expectedLength = sizeof(SuffixArrayCacheHeader) + (oldSize + 1) * entryWidth;
+
+		if(fstat(fd, &info) != 0 || (size_t) info.st_size != expectedLength)
+		{
+			close(fd);
+			return false;
+		}
+
+		void * file = mmap(nullptr, expectedLength, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if(file == MAP_FAILED)
+			return false;
+
+		const auto * header = (const SuffixArrayCacheHeader *) file;
+		void * cachedIndex = (uint8_t *) file + sizeof(SuffixArrayCacheHeader);
+		const off_t firstEntry = isCompact ? *(const int32_t *) cachedIndex : *(const off_t *) cachedIndex;
+
+		//The empty suffix is always first, which is a cheap check we're not looking at garbage
+		if(memcmp(header->magic, SUFFIX_CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != SUFFIX_CACHE_VERSION
+		   || header->entryWidth != entryWidth || header->imageLength != oldSize || firstEntry != (off_t) oldSize)
+		{
+			munmap(file, expectedLength);
+			return false;
+		}
+
+		mapping = file;
+		mappingLength = expectedLength;
+		index = {cachedIndex, isCompact};
+		return true;
+	}
+
+	void release()
+	{
+		if(mapping != nullptr)
+			munmap(mapping, mappingLength);
+		else
+			free(index.index);
+
+		index.index = nullptr;
+		mapping = nullptr;
+		mappingLength = 0;
+	}
+};
+
+static string cachePathForImage(const uint8_t * old, size_t oldSize)
+{
+	uint8_t hash[HASH_LENGTH];
+	char hex[2 * HASH_LENGTH + 1];
+
+	hashMemory(old, oldSize, hash);
+	hydro_bin2hex(hex, sizeof(hex), hash, sizeof(hash));
+
+	return string(_suffixArrayCacheDir) + "/" + hex + ".sa";
+}
+
+static void writeCacheFile(const string & path, const SuffixArray & index, size_t oldSize)
+{
+	if(mkdir(_suffixArrayCacheDir, 0755) != 0 && errno != EEXIST)
+	{
+		warn("Couldn't create the suffix array cache directory %s", _suffixArrayCacheDir);
+		return;
+	}
+
+	SuffixArrayCacheHeader header = {};
+	memcpy(header.magic, SUFFIX_CACHE_MAGIC, sizeof(header.magic));
+	header.version = SUFFIX_CACHE_VERSION;
+	header.entryWidth = (uint32_t) index.entryWidth();
+	header.imageLength = oldSize;
+
+	//We write to a temporary file first so that a concurrent run never maps a partial cache
+	const string temporaryPath = path + ".tmp." + to_string(getpid());
+	FILE * file = fopen(temporaryPath.c_str(), "wb");
+	if(file == nullptr)
+	{
+		warn("Couldn't create the suffix array cache file %s", temporaryPath.c_str());
+		return;
+	}
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1
+				   && fwrite(index.index, index.entryWidth(), oldSize + 1, file) == oldSize + 1;
+
+	success &= fclose(file) == 0;
+
+	if(!success || rename(temporaryPath.c_str(), path.c_str()) != 0)
+	{
+		warn("Couldn't write the suffix array cache file %s", path.c_str());
+		remove(temporaryPath.c_str());
+	}
+}
+
+//The suffixes of old + skip are sorted the same way as the suffixes of old starting after skip
+template<typename Index>
+static Index * sliceSuffixArray(const Index * fullIndex, size_t oldSize, size_t skip)
+{
+	auto * index = (Index *) malloc((oldSize - skip + 1) * sizeof(Index));
+	if(index == nullptr)
+		err(1, "Malloc error");
+
+	for(size_t i = 0, output = 0; i <= oldSize; i++)
+	{
+		if(fullIndex[i] >= (Index) skip)
+			index[output++] = fullIndex[i] - (Index) skip;
+	}
+
+	return index;
+}
+
+void bsdiffWithCache(const uint8_t * old, size_t oldSize, size_t skip, const uint8_t * newer, size_t newSize, const vector<MatchedRange> & matched, vector<BSDiffPatch> & patch, PatchArena & deltaArena)
+{
+	assert(skip <= oldSize);
+
+	if(_suffixArrayCacheDir == nullptr)
+	{
+		SuffixArray index = buildSuffixArray(old + skip, oldSize - skip, _suffixSortEngine);
+		bsdiff(old + skip, oldSize - skip, newer, newSize, index, matched, patch, deltaArena);
+		free(index.index);
+		return;
+	}
+
+	//We cache the suffix array of the full image, as the skip depends on the new image
+	const string path = cachePathForImage(old, oldSize);
+	CachedSuffixArray cache;
+
+	if(!cache.loadFromFile(path, oldSize))
+	{
+		cache.index = buildSuffixArray(old, oldSize, _suffixSortEngine);
+		writeCacheFile(path, cache.index, oldSize);
+	}
+
+	if(skip == 0)
+	{
+		bsdiff(old, oldSize, newer, newSize, cache.index, matched, patch, deltaArena);
+	}
+	else
+	{
+		//The slice is smaller than the full image, so it can always use the width of the full index
+		SuffixArray index = {nullptr, cache.index.isCompact};
+		if(index.isCompact)
+			index.index = sliceSuffixArray((const int32_t *) cache.index.index, oldSize, skip);
+		else
+			index.index = sliceSuffixArray((const off_t *) cache.index.index, oldSize, skip);
+
+		bsdiff(old + skip, oldSize - skip, newer, newSize, index, matched, patch, deltaArena);
+		free(index.index);
+	}
+
+	cache.release();
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <err.h>
+
+/*
+ * Linear time suffix sorting (SA-IS, Nong, Zhang & Chan 2009).
+ *
+ * The output has the same layout as qsufsort: oldSize + 1 entries, the first one being the empty suffix.
+ * The empty suffix is handled as a virtual sentinel smaller than any byte, so that we don't have to copy the image.
+ */
+
+#define SA_INDEX off_t
+#define SA_NAME(name) name
+#include "sais_template.h"
+#undef SA_NAME
+#undef SA_INDEX
+
+#define SA_INDEX int32_t
+#define SA_NAME(name) name##32
+#include "sais_template.h"
+#undef SA_NAME
+#undef SA_INDEX
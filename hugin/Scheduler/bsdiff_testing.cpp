@@ -47,7 +47,13 @@ bool validateBSDiff(const uint8_t * original, size_t originalLength, const uint8
 #ifdef PRINT_BSDIFF
 		fprintf(file, "[0x%zx] Copying %zu from 0x%zx then adding %zu new bytes\n", currentOffset, cur.lengthDelta, cur.oldDataAddress, cur.lengthExtra);
 #endif
-		if(cur.lengthDelta)
+		//Untouched pages are left as is
+		if(cur.untouched)
+		{
+			assert(cur.oldDataAddress == currentOffset && cur.lengthExtra == 0);
+			currentOffset += cur.lengthDelta;
+		}
+		else if(cur.lengthDelta)
 		{
 			assert(cur.oldDataAddress + cur.lengthDelta <= originalLength);
 			memcpy(&virtualFlash[currentOffset], &original[cur.oldDataAddress], cur.lengthDelta);
@@ -23,7 +23,8 @@ void extractSubSectionToLoad(const DetailedBlockMetadata & toExtract, const Cach
 
 		for(size_t index = 0, outputLength = output.size(); index < outputLength; )
 		{
-			auto & originalSegment = output[index];
+			//Copied as emplace_back may reallocate output
+			const DetailedBlockMetadata originalSegment = output[index];
 
 			// We're not tagging segments that are now in use. Might be a problem but would generate a ton of noise for _loadTaggedToTMP
 			if(curTmp.overlapWith(originalSegment.source, originalSegment.length))
@@ -34,7 +35,7 @@ void extractSubSectionToLoad(const DetailedBlockMetadata & toExtract, const Cach
 					//We're starting before, so we add back the segment before the match
 					if(originalSegment.source < curTmp.source)
 					{
-						output.emplace_back(DetailedBlockMetadata(output[index].source, curTmp.source.getAddress() - originalSegment.source.getAddress()));
+						output.emplace_back(DetailedBlockMetadata(originalSegment.source, curTmp.source.getAddress() - originalSegment.source.getAddress()));
 						outputLength += 1;
 					}
 					
@@ -42,7 +43,7 @@ void extractSubSectionToLoad(const DetailedBlockMetadata & toExtract, const Cach
 					if(originalSegment.source + originalSegment.length > curTmp.source + curTmp.length)
 					{
 						const size_t offsetCacheEndToTranslation = (curTmp.source.value + curTmp.length) - originalSegment.source.value;
-						output.emplace_back(DetailedBlockMetadata(output[index].source + offsetCacheEndToTranslation,
+						output.emplace_back(DetailedBlockMetadata(originalSegment.source + offsetCacheEndToTranslation,
 																  originalSegment.source.value + originalSegment.length - (curTmp.source.value + curTmp.length)));
 						outputLength += 1;
 					}
@@ -152,6 +153,8 @@ void VirtualMemory::_retagReusedToken(const DetailedBlock & dataToLoad)
 			}
 		}
 	}
+
+	cacheLayout.layoutChanged();
 #ifdef VERY_AGGRESSIVE_ASSERT
 	Address curPos(CACHE_BUF);
 	for(const auto & cacheSegment : cacheLayout.segments)
@@ -303,6 +306,7 @@ void VirtualMemory::_loadTaggedToTMP(const DetailedBlock & dataToLoad, Scheduler
 #endif
 	commands.finishTransaction();
 	cacheLayout = tmpLayoutCopy;
+	cacheLayout.layoutChanged();
 }
 
 void VirtualMemory::loadTaggedToTMP(const DetailedBlock & dataToLoad, SchedulerData & commands)
@@ -335,7 +339,10 @@ void VirtualMemory::loadTaggedToTMP(const DetailedBlock & dataToLoad, SchedulerD
 
 	//Make the cache more readable in the debugger
 	if(lengthAlreadyInCache + lengthToFitInCache > BLOCK_SIZE)
+	{
 		cacheLayout.trimUntagged();
+		cacheLayout.layoutChanged();
+	}
 
 	//If this assert fail, we're trying to load too much data in the cache
 	assert(lengthAlreadyInCache + lengthToFitInCache <= BLOCK_SIZE);
@@ -65,14 +65,132 @@
 #define BSDIFF_DELTA_REMOVAL_THRESHOLD 10
 
 //Encoder related config
-#define FLASH_SIZE_BIT_DEFAULT	20u		//How many bits should be used to encode addresses
-#define BLOCK_SIZE_BIT_DEFAULT	12u		// 4096, 0x1000
+//	A build made for a single device may fix its geometry. The masks and shifts then become constants the compiler can fold,
+//	but patches can't be generated for any other geometry
+//#define FIXED_FLASH_SIZE_BIT	20u
+//#define FIXED_BLOCK_SIZE_BIT	12u
+
+#ifdef FIXED_FLASH_SIZE_BIT
+	#define FLASH_SIZE_BIT_DEFAULT	FIXED_FLASH_SIZE_BIT
+#else
+	#define FLASH_SIZE_BIT_DEFAULT	20u		//How many bits should be used to encode addresses
+#endif
+
+#ifdef FIXED_BLOCK_SIZE_BIT
+	#define BLOCK_SIZE_BIT_DEFAULT	FIXED_BLOCK_SIZE_BIT
+#else
+	#define BLOCK_SIZE_BIT_DEFAULT	12u		// 4096, 0x1000
+#endif
+
+//Each thread has its own geometry, so that patches for devices with different page and flash sizes can be generated concurrently
+//	Use FlashGeometryScope rather than writing them directly
+extern thread_local size_t _realBlockSizeBit;
+extern thread_local size_t _realFullAddressSpace;
+
+struct FlashGeometry
+{
+	size_t blockSizeBit;
+	size_t fullAddressSpace;
+
+	FlashGeometry(size_t blockSizeBit, size_t fullAddressSpace) : blockSizeBit(blockSizeBit), fullAddressSpace(fullAddressSpace) {}
 
-extern size_t _realBlockSizeBit;
-extern size_t _realFullAddressSpace;
+	//Geometry in use by the calling thread
+	static FlashGeometry current()	{	return FlashGeometry(_realBlockSizeBit, _realFullAddressSpace);	}
 
-#define BLOCK_SIZE_BIT ((const uint8_t) _realBlockSizeBit)
-#define FLASH_SIZE_BIT ((const uint8_t) _realFullAddressSpace)
+	//Builds with a fixed geometry only support this geometry
+	bool isSupported() const
+	{
+#ifdef FIXED_BLOCK_SIZE_BIT
+		if(blockSizeBit != FIXED_BLOCK_SIZE_BIT)
+			return false;
+#endif
+#ifdef FIXED_FLASH_SIZE_BIT
+		if(fullAddressSpace != FIXED_FLASH_SIZE_BIT)
+			return false;
+#endif
+		return true;
+	}
+};
+
+//Use a geometry on the calling thread until the scope is left
+//	Threads start with the default geometry, workers must open a scope with the geometry of the thread spawning them
+class FlashGeometryScope
+{
+	FlashGeometry previous;
+
+public:
+	explicit FlashGeometryScope(const FlashGeometry & geometry) : previous(FlashGeometry::current())
+	{
+		_realBlockSizeBit = geometry.blockSizeBit;
+		_realFullAddressSpace = geometry.fullAddressSpace;
+	}
+
+	FlashGeometryScope(const FlashGeometryScope &) = delete;
+	FlashGeometryScope & operator=(const FlashGeometryScope &) = delete;
+
+	~FlashGeometryScope()
+	{
+		_realBlockSizeBit = previous.blockSizeBit;
+		_realFullAddressSpace = previous.fullAddressSpace;
+	}
+};
+
+//How many threads the diff may use
+#define THREAD_COUNT_DEFAULT	1u
+extern size_t _realThreadCount;
+
+//Timings of the flash of the device, used to estimate how long installing an update takes
+//	The defaults are those of a typical MCU internal flash (nRF52 class)
+#define FLASH_ERASE_MS_PER_PAGE_DEFAULT		85.0
+#define FLASH_PROGRAM_US_PER_BYTE_DEFAULT	10.0
+#define FLASH_READ_US_PER_BYTE_DEFAULT		0.02
+
+struct FlashTimingProfile
+{
+	double eraseMsPerPage;
+	double programUsPerByte;
+	double readUsPerByte;
+};
+
+extern FlashTimingProfile _flashTimingProfile;
+
+//Portfolio mode: each network is solved with several swap heuristics, and we keep the solution scoring best
+//	Candidates are compared on the size of their encoded commands, on the number of erases or on the estimated install time first
+enum PortfolioMode
+{
+	PORTFOLIO_DISABLED,
+	PORTFOLIO_SMALLEST_STREAM,
+	PORTFOLIO_FEWEST_ERASES,
+	PORTFOLIO_FASTEST_INSTALL
+};
+
+extern PortfolioMode _portfolioMode;
+
+//Format of the commands, one of the MANIFEST_FORMAT_* of layout.h. Munin must be built to accept it
+extern uint16_t _manifestFormat;
+
+//Erases between two resume checkpoints in the MANIFEST_FORMAT_CHECKPOINTED format, each checkpoint taking 22 bytes
+#define CHECKPOINT_INTERVAL 16u
+
+//Size of the sections of the new image scanned concurrently by bsdiff when using multiple threads
+#define PARALLEL_SCAN_REGION_SIZE	(256u << 10u)
+
+//Shifted runs detection: width of the rolling hash, shortest run we report and largest gap between two runs we merge
+#define SHIFT_DETECTOR_WINDOW		32u
+#define SHIFT_DETECTOR_MIN_RUN		512u
+#define SHIFT_DETECTOR_MAX_GAP		64u
+
+#ifdef FIXED_BLOCK_SIZE_BIT
+	#define BLOCK_SIZE_BIT ((const uint8_t) FIXED_BLOCK_SIZE_BIT)
+#else
+	#define BLOCK_SIZE_BIT ((const uint8_t) _realBlockSizeBit)
+#endif
+
+#ifdef FIXED_FLASH_SIZE_BIT
+	#define FLASH_SIZE_BIT ((const uint8_t) FIXED_FLASH_SIZE_BIT)
+#else
+	#define FLASH_SIZE_BIT ((const uint8_t) _realFullAddressSpace)
+#endif
 
 //Need to be usable as a masks
 #define BLOCK_SIZE 			(1u << BLOCK_SIZE_BIT)
@@ -13,6 +13,9 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
 #include <iostream>
 #include <vector>
 
@@ -28,11 +31,16 @@ bool runDynamicTest(const uint8_t * original, size_t originalLength, const uint8
 	bool output = true;
 	SchedulerPatch patch;
 
-	//We set the address space to the largest binary
-	_realFullAddressSpace = numberOfBitsNecessary(originalLength > newLength ? originalLength : newLength);
+	//We set the address space to the largest binary, unless the build can't use anything else
+#ifdef FIXED_FLASH_SIZE_BIT
+	const FlashGeometry geometry = FlashGeometry::current();
+#else
+	const FlashGeometry geometry(BLOCK_SIZE_BIT, numberOfBitsNecessary(originalLength > newLength ? originalLength : newLength));
+#endif
+	FlashGeometryScope geometryScope(geometry);
 
 	//Generate the patch
-	if(generatePatch(original, originalLength, newer, newLength, patch, false))
+	if(generatePatch(original, originalLength, newer, newLength, patch, geometry, false))
 	{
 		//If the files are identical, we're done
 		if(patch.bsdiff.empty())
@@ -56,13 +64,7 @@ bool runDynamicTest(const uint8_t * original, size_t originalLength, const uint8
 			goto cleanup;
 		}
 
-		size_t length;
-		uint8_t * encodedCommands = nullptr;
-		Encoder encoder;
-		encoder.encode(patch.commands, encodedCommands, length);
-		free(encodedCommands);
-
-		cout << "Encoded command payload would take " << length << " bytes." << endl;
+		cout << "Encoded command payload would take " << Encoder(geometry, patch.format).measure(patch.commands) << " bytes." << endl;
 
 		if(!writeBSDiff(patch, file))
 		{
@@ -94,30 +96,21 @@ bool runDynamicTest(const uint8_t * original, size_t originalLength, const uint8
 
 cleanup:
 
-	patch.clear(true);
+	patch.clear();
 	return output;
 }
 
 bool runDynamicTestWithFiles(const char * original, const char * newFile)
 {
-	size_t originalLength, newLength;
+	ImageFile originalData, newData;
 
-	uint8_t * originalData = readFile(original, &originalLength);
-	uint8_t * newData = readFile(newFile, &newLength);
-	
-	if(originalData == nullptr || newData == nullptr)
+	if(!originalData.open(original) || !newData.open(newFile))
 	{
 		cout << "Missing test files (" << original << " / " << newFile << ")!" << endl;
-
-		free(originalData);
-		free(newData);
 		return true;
 	}
 
-	bool output = runDynamicTest(originalData, originalLength, newData, newLength);
-
-	free(originalData);
-	free(newData);
+	bool output = runDynamicTest(originalData.data, originalData.length, newData.data, newData.length);
 
 	if(output)
 	{
@@ -130,3 +123,71 @@ bool runDynamicTestWithFiles(const char * original, const char * newFile)
 
 	return output;
 }
+
+//Compare a suffix array, of either width, against a 64 bits reference
+static bool sameSuffixArray(const SuffixArray & reference, const SuffixArray & array, size_t length)
+{
+	if(!array.isCompact)
+		return !memcmp(reference.index, array.index, (length + 1) * sizeof(off_t));
+
+	const auto * referenceIndex = (const off_t *) reference.index;
+	const auto * compactIndex = (const int32_t *) array.index;
+
+	for(size_t i = 0; i <= length; ++i)
+	{
+		if(referenceIndex[i] != compactIndex[i])
+			return false;
+	}
+
+	return true;
+}
+
+bool benchmarkSuffixSort(const char * file)
+{
+	ImageFile image;
+
+	if(!image.open(file))
+	{
+		cout << "Missing test file (" << file << ")!" << endl;
+		return true;
+	}
+
+	const uint8_t * data = image.data;
+	const size_t length = image.length;
+
+	//The parallel engine is run with at least two threads so that the dispatch is exercised
+	const size_t previousThreadCount = _realThreadCount;
+	const unsigned int hardwareThreads = thread::hardware_concurrency();
+	_realThreadCount = hardwareThreads > 2 ? hardwareThreads : 2;
+
+	//The reference always uses 64 bits indexes, the others use the compact ones when the file is small enough
+	auto begin = chrono::high_resolution_clock::now();
+	SuffixArray reference = buildSuffixArray(data, length, SUFFIX_SORT_QSUFSORT, false);
+	auto middle = chrono::high_resolution_clock::now();
+	SuffixArray compact = buildSuffixArray(data, length, SUFFIX_SORT_QSUFSORT);
+	auto middle2 = chrono::high_resolution_clock::now();
+	SuffixArray linear = buildSuffixArray(data, length, SUFFIX_SORT_SAIS);
+	auto middle3 = chrono::high_resolution_clock::now();
+	SuffixArray parallel = buildSuffixArray(data, length, SUFFIX_SORT_PARALLEL);
+	auto end = chrono::high_resolution_clock::now();
+
+	bool output = sameSuffixArray(reference, compact, length) && sameSuffixArray(reference, linear, length) && sameSuffixArray(reference, parallel, length);
+
+	cout << "Suffix sorting " << file << ": qsufsort in " << chrono::duration_cast<chrono::milliseconds>(middle - begin).count()
+		 << " ms (" << (length + 1) * reference.entryWidth() << " bytes index), "
+		 << (compact.isCompact ? "compact " : "") << "qsufsort in " << chrono::duration_cast<chrono::milliseconds>(middle2 - middle).count()
+		 << " ms (" << (length + 1) * compact.entryWidth() << " bytes index), SA-IS in " << chrono::duration_cast<chrono::milliseconds>(middle3 - middle2).count()
+		 << " ms, parallel (" << _realThreadCount << " threads) in " << chrono::duration_cast<chrono::milliseconds>(end - middle3).count() << " ms." << endl;
+
+	if(!output)
+		cout << "Suffix sorting engines disagree!" << endl;
+
+	_realThreadCount = previousThreadCount;
+
+	free(parallel.index);
+	free(linear.index);
+	free(compact.index);
+	free(reference.index);
+
+	return output;
+}
@@ -35,16 +35,16 @@ struct NetworkNode
 	bool isFinal;
 	bool needRefreshLargestToken;
 
-	NetworkNode(const BlockID & curBlockID, const vector<NetworkToken> & allTokens) : block(curBlockID), blockFinalLayout(curBlockID),
+	NetworkNode(const BlockID & curBlockID, vector<NetworkToken> && allTokens) : block(curBlockID), blockFinalLayout(curBlockID),
 				nbSourcesOut(0), sumOut(0), lengthFinalLayout(0),
 #ifdef PRINT_SELECTED_LINKS
 				touchCount(0),
 #endif
-				largestToken(0), isFinal(false), needRefreshLargestToken(false)
+				largestToken(0), largestTokenWeight(INT64_MIN), isFinal(false), needRefreshLargestToken(false)
 	{
 		//Very expensive,
-		for(const auto & token : allTokens)
-			appendToken(token);
+		for(auto & token : allTokens)
+			appendToken(move(token));
 
 #ifdef VERY_AGGRESSIVE_ASSERT
 		assert(getOccupationLevel() <= BLOCK_SIZE);
@@ -56,7 +56,7 @@ struct NetworkNode
 #ifdef PRINT_SELECTED_LINKS
 				touchCount(0),
 #endif
-				largestToken(0), isFinal(false), needRefreshLargestToken(false)
+				largestToken(0), largestTokenWeight(INT64_MIN), isFinal(false), needRefreshLargestToken(false)
 	{
 		//We first import sourceID matches, allTokens are sorted by sourceID
 		auto startSourceID = lower_bound(allTokens.cbegin(), allTokens.cend(), block, [](const NetworkToken & a, const BlockID & b) { return a.sourceBlockID < b; });
@@ -132,7 +132,9 @@ struct NetworkNode
 		}
 	}
 
-	void appendToken(const NetworkToken & token)
+	//Takes over the token if passed an rvalue, copies it otherwise
+	template<typename TokenReference>
+	void appendToken(TokenReference && token)
 	{
 		if(token.sourceBlockID == block)
 		{
@@ -161,7 +163,10 @@ struct NetworkNode
 			}
 
 			if(!foundExisting)
-				tokens.insert(lower_bound(tokens.begin(), tokens.end(), token), token);
+			{
+				const auto position = lower_bound(tokens.begin(), tokens.end(), token);
+				tokens.insert(position, forward<TokenReference>(token));
+			}
 		}
 		else if(token.destinationBlockID == block)
 		{
@@ -191,7 +196,10 @@ struct NetworkNode
 
 	size_t getOccupationLevel() const
 	{
-		DetailedBlock layout;
+		//Called for every candidate layout, so we reuse the storage of the previous call (per thread, as networks are solved concurrently)
+		static thread_local DetailedBlock layout;
+		layout.segments.clear();
+		layout.sorted = true;
 
 		size_t output = isFinal ? lengthFinalLayout : 0;
 
@@ -330,11 +338,42 @@ struct NetworkNode
 	DetailedBlock compileLayout() const;
 };
 
+//How links are weighted when picking the next swap. The default is the historical heuristic, the portfolio mode tries others
+struct SwapHeuristic
+{
+	//A link is worth matchedWeight per byte exchanged both ways, minus unbalanceWeight per byte going only one way
+	int64_t matchedWeight;
+	int64_t unbalanceWeight;
+
+	//Bonus of the links to (or from) the block with a pending cached write, which can then be written in a single pass
+	int64_t cachedWriteDestinationBonus;
+	int64_t cachedWriteSourceBonus;
+
+	//If not 0, nodes with links of the same weight are ordered by a hash of their block instead of their position
+	uint64_t tieBreakSeed;
+
+	SwapHeuristic(int64_t matchedWeight = 3, int64_t unbalanceWeight = 2, int64_t cachedWriteDestinationBonus = 5, int64_t cachedWriteSourceBonus = 3, uint64_t tieBreakSeed = 0) :
+			matchedWeight(matchedWeight), unbalanceWeight(unbalanceWeight), cachedWriteDestinationBonus(cachedWriteDestinationBonus), cachedWriteSourceBonus(cachedWriteSourceBonus), tieBreakSeed(tieBreakSeed) {}
+};
+
 class Network
 {
 	vector<NetworkNode> nodes;
+	SwapHeuristic heuristic;
 	VirtualMemory memoryLayout;
-	unordered_map<BlockID, size_t> nodeIndex;
+	BlockTable<size_t> nodeIndex;
+
+	//Nodes weighted by their largest token, so that picking the next swap doesn't require going through every node
+	//	Nodes touched by a swap are queued, and only reweighted by the next findLargestToken
+	IndexedMaxHeap largestTokens;
+	vector<size_t> nodesToRequeue;
+	vector<bool> isQueued;
+	BlockID queuedCachedWriteBlock;
+
+	//Nodes whose largest token goes to a given block, or was cleared. Used to find the links made stale by a swap
+	unordered_map<BlockID, unordered_set<size_t>> largestTokenDestinations;
+	unordered_set<size_t> clearedLargestTokens;
+	vector<BlockID> indexedDestination;
 
 	void buildNetworkTokenArray(const vector<Block> &blocks, const vector<size_t> &network, vector<NetworkToken> &tokens) const;
 	void performToken(NetworkNode & source, NetworkNode & destination, SchedulerData & schedulerData);
@@ -343,29 +382,47 @@ class Network
 	void pulledEverythingForNode(NetworkNode & node, const vector<BlockID> & nodeSources);
 	NetworkToken findLargestToken();
 
+	void queueNode(size_t nodeID)
+	{
+		if(!isQueued[nodeID])
+		{
+			isQueued[nodeID] = true;
+			nodesToRequeue.push_back(nodeID);
+		}
+	}
+
+	void queueNode(const NetworkNode & node)	{	queueNode((size_t) (&node - nodes.data()));	}
+	void queueNodesTargeting(const BlockID & block);
+	void requeueNodes();
+	void indexLargestToken(size_t nodeID);
+	bool weighLargestToken(const NetworkNode & node, int64_t & weight) const;
+
 	NetworkNode & findNodeWithBlock(const BlockID & block)
 	{
 		return nodes[nodeIndex[block]];
 	}
 
 public:
-	Network(const vector<Block> & blocks, const vector<size_t> & network) : memoryLayout(blocks, network)
+	Network(const vector<Block> & blocks, const vector<size_t> & network, const SwapHeuristic & heuristic = SwapHeuristic()) : heuristic(heuristic), memoryLayout(blocks, network), nodeIndex(blocks, network), largestTokens(network.size()),
+																			isQueued(network.size(), false), queuedCachedWriteBlock(CACHE_BUF), indexedDestination(network.size(), CACHE_BUF)
 	{
 		vector<NetworkToken> tokens;
 		buildNetworkTokenArray(blocks, network, tokens);
 
 		nodes.reserve(network.size());
-		nodeIndex.reserve(network.size());
 
 		size_t counter = 0;
 		for(const size_t & blockIndex : network)
 		{
 			nodes.emplace_back(blocks[blockIndex], tokens);
-			nodeIndex.emplace(blocks[blockIndex].blockID, counter++);
+			nodeIndex[blocks[blockIndex].blockID] = counter++;
 		}
 
 		for(auto & node : nodes)
+		{
 			node.refreshLargestToken([&](const NetworkToken & token) { return computeLinkWeigth(token); });
+			queueNode(node);
+		}
 	}
 
 	bool performBestSwap(SchedulerData & schedulerData);
@@ -375,9 +432,9 @@ public:
 		size_t backLinkWeight = 0;
 
 		auto index = nodeIndex.find(token.destinationBlockID);
-		if(index != nodeIndex.end())
+		if(index != nullptr)
 		{
-			const NetworkNode & dest = nodes[index->second];
+			const NetworkNode & dest = nodes[*index];
 			if(dest.nbSourcesOut > 0)
 			{
 				for(const auto & destToken : dest.tokens)
@@ -391,7 +448,7 @@ public:
 			}
 		}
 
-		return 3 * MIN(backLinkWeight, token.length) - 2 * abs((long long int) (backLinkWeight - token.length));
+		return heuristic.matchedWeight * (int64_t) MIN(backLinkWeight, token.length) - heuristic.unbalanceWeight * abs((long long int) (backLinkWeight - token.length));
 	}
 
 	void performFinalFlush(SchedulerData & schedulerData);
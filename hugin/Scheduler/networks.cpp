@@ -64,10 +64,8 @@ void NetworkNode::tookOverNode(const NetworkNode & pulledNode, bool bypassBlockI
 			{
 				const long tokenIterIndex = token - tokens.begin();
 
-				auto newToken = *pulledIter;
-				newToken.sourceBlockID = block;
-				tokens.insert(token, newToken);
-				sumOut += newToken.length;
+				tokens.insert(token, *pulledIter)->sourceBlockID = block;
+				sumOut += pulledIter->length;
 				nbSourcesOut += 1;
 
 				token = tokens.begin() + tokenIterIndex;
@@ -108,10 +106,9 @@ void NetworkNode::tookOverNode(const NetworkNode & pulledNode, bool bypassBlockI
 				//We don't duplicate the insertion of our own data. lengthWon will take care of it later
 				if(pulledIter->destinationBlockID != block || bypassBlockIDDrop)
 				{
-					auto newToken = *pulledIter;
-					newToken.sourceBlockID = block;
-					tokens.insert(tokens.end(), newToken);
-					sumOut += newToken.length;
+					tokens.emplace_back(*pulledIter);
+					tokens.back().sourceBlockID = block;
+					sumOut += pulledIter->length;
 					nbSourcesOut += 1;
 				}
 				else
@@ -153,7 +150,8 @@ void NetworkNode::tookOverNode(const NetworkNode & pulledNode, bool bypassBlockI
 		{
 			auto newToken = pulledTokens[lengthWon];
 			newToken.sourceBlockID = block;
-			tokens.insert(upper_bound(tokens.begin(), tokens.end(), newToken), newToken);
+			const auto position = upper_bound(tokens.begin(), tokens.end(), newToken);
+			tokens.insert(position, move(newToken));
 		}
 	}
 }
@@ -444,59 +442,139 @@ void Network::buildNetworkTokenArray(const vector<Block> &blocks, const vector<s
 	}
 }
 
-NetworkToken Network::findLargestToken()
+bool Network::weighLargestToken(const NetworkNode & node, int64_t & weight) const
 {
-	NetworkToken invalidToken({Address(0), 0, Address(0)});	invalidToken.cleared = true;
-	NetworkToken & outputToken = invalidToken;
-	int64_t maxToken = INT64_MIN;
+	//If the node has no outgoing data, there is no outgoing link.
+	//If the node is final, its data could be pulled whenever the receiving node turn final
+	if(node.nbSourcesOut == 0 || node.isFinal)
+		return false;
 
-	for(auto & node : nodes)
+	if(node.tokens.size() <= node.largestToken)
+		return false;
+
+	const auto & token = node.tokens[node.largestToken];
+	if(token.cleared)
+		return false;
+
+	assert(token.sourceBlockID == node.block);
+
+	//This may happen if all nodes requesting data from this node turned final, without selecting our links
+	// In those cases, all links but the internal one may have been deleted
+	if(token.sourceBlockID == token.destinationBlockID)
+		return false;
+
+	int64_t bonus = 0;
+	if(memoryLayout.hasCachedWrite)
 	{
-		//If the node has no outgoing data, there is no outgoing link.
-		//If the node is final, its data could be pulled whenever the receiving node turn final
-		if(node.nbSourcesOut == 0 || node.isFinal)
-			continue;
+		//This let us cleanly
+		if(memoryLayout.cachedWriteBlock == token.destinationBlockID)
+			bonus = heuristic.cachedWriteDestinationBonus;
+		else if(memoryLayout.cachedWriteBlock == token.sourceBlockID)
+			bonus = heuristic.cachedWriteSourceBonus;
+	}
 
-		//Does the need need an update?
-		if(node.needRefreshLargestToken)
-		{
-			node.refreshLargestToken([&](const NetworkToken & token) { return computeLinkWeigth(token); });
-			node.needRefreshLargestToken = false;
-		}
+	//Links at INT64_MIN were never selected by the linear scan
+	weight = node.largestTokenWeight + bonus;
+	if(weight == INT64_MIN)
+		return false;
 
-		if(node.tokens.size() <= node.largestToken)
-			continue;
+	//The weight is scaled so that the hash only orders links that would otherwise be tied
+	if(heuristic.tieBreakSeed != 0 && node.largestTokenWeight != INT64_MIN)
+	{
+		uint64_t hash = (heuristic.tieBreakSeed ^ node.block.value) * 0x9E3779B97F4A7C15ull;
+		hash ^= hash >> 32u;
+		weight = weight * 256 + (int64_t) (hash & 0xFFu);
+	}
+
+	return true;
+}
+
+void Network::indexLargestToken(size_t nodeID)
+{
+	const NetworkNode & node = nodes[nodeID];
 
+	auto previous = largestTokenDestinations.find(indexedDestination[nodeID]);
+	if(previous != largestTokenDestinations.end())
+		previous->second.erase(nodeID);
+
+	clearedLargestTokens.erase(nodeID);
+
+	if(node.largestToken < node.tokens.size())
+	{
 		const auto & token = node.tokens[node.largestToken];
-		if(token.cleared)
-			continue;
 
-		assert(token.sourceBlockID == node.block);
+		indexedDestination[nodeID] = token.destinationBlockID;
+		largestTokenDestinations[token.destinationBlockID].insert(nodeID);
 
-		//This may happen if all nodes requesting data from this node turned final, without selecting our links
-		// In those cases, all links but the internal one may have been deleted
-		if(token.sourceBlockID == token.destinationBlockID)
-			continue;
+		if(token.cleared)
+			clearedLargestTokens.insert(nodeID);
+	}
+}
 
-		long bonus = 0;
-		if(memoryLayout.hasCachedWrite)
+void Network::queueNodesTargeting(const BlockID & block)
+{
+	auto targeting = largestTokenDestinations.find(block);
+	if(targeting != largestTokenDestinations.end())
+	{
+		for(const size_t nodeID : targeting->second)
+			queueNode(nodeID);
+	}
+}
+
+void Network::requeueNodes()
+{
+	//The cached write bonus moved, the nodes it applied or now applies to must be reweighted
+	const BlockID cachedWriteBlock = memoryLayout.hasCachedWrite ? memoryLayout.cachedWriteBlock : BlockID(CACHE_BUF);
+	if(cachedWriteBlock != queuedCachedWriteBlock)
+	{
+		for(const BlockID & block : {queuedCachedWriteBlock, cachedWriteBlock})
 		{
-			//This let us cleanly
-			if(memoryLayout.cachedWriteBlock == token.destinationBlockID)
-				bonus = 5;
-			else if(memoryLayout.cachedWriteBlock == token.sourceBlockID)
-				bonus = 3;
+			auto node = nodeIndex.find(block);
+			if(node != nullptr)
+				queueNode(*node);
+
+			queueNodesTargeting(block);
 		}
 
-		//We need to find a way to cache that
-		const auto linkWeight = node.largestTokenWeight + bonus;
-		if(linkWeight > maxToken)
+		queuedCachedWriteBlock = cachedWriteBlock;
+	}
+
+	for(const size_t nodeID : nodesToRequeue)
+	{
+		NetworkNode & node = nodes[nodeID];
+		isQueued[nodeID] = false;
+
+		//Does the need need an update?
+		if(node.needRefreshLargestToken && node.nbSourcesOut != 0 && !node.isFinal)
 		{
-			outputToken = token;
-			maxToken = linkWeight;
+			node.refreshLargestToken([&](const NetworkToken & token) { return computeLinkWeigth(token); });
+			node.needRefreshLargestToken = false;
 		}
+
+		indexLargestToken(nodeID);
+
+		int64_t weight;
+		if(weighLargestToken(node, weight))
+			largestTokens.update(nodeID, weight);
+		else
+			largestTokens.remove(nodeID);
 	}
-	return outputToken;
+
+	nodesToRequeue.clear();
+}
+
+NetworkToken Network::findLargestToken()
+{
+	requeueNodes();
+
+	if(largestTokens.empty())
+	{
+		NetworkToken invalidToken({Address(0), 0, Address(0)});	invalidToken.cleared = true;
+		return invalidToken;
+	}
+
+	const NetworkNode & node = nodes[largestTokens.top()];
+	return node.tokens[node.largestToken];
 }
 
 void Network::performToken(NetworkNode & source, NetworkNode & destination, SchedulerData & schedulerData)
@@ -512,7 +590,7 @@ void Network::performToken(NetworkNode & source, NetworkNode & destination, Sche
 	auto sourceCoreIter = lower_bound(tokenPool.begin(), tokenPool.end(), source.block);
 	if(sourceCoreIter != tokenPool.end() && sourceCoreIter->destinationBlockID == source.block)
 	{
-		oldSource = *sourceCoreIter;
+		oldSource = move(*sourceCoreIter);
 		oldSource.removeInternalOverlap();
 		tokenPool.erase(sourceCoreIter);
 		hadSource = true;
@@ -527,7 +605,7 @@ void Network::performToken(NetworkNode & source, NetworkNode & destination, Sche
 	assert(destinationCoreIter != tokenPool.end());
 	assert(destinationCoreIter->destinationBlockID == destination.block);
 
-	NetworkToken destinationCore = *destinationCoreIter;
+	NetworkToken destinationCore = move(*destinationCoreIter);
 	destinationCore.sourceBlockID = destinationCore.destinationBlockID;
 	destinationCore.cleared = false;
 	tokenPool.erase(destinationCoreIter);
@@ -540,9 +618,14 @@ void Network::performToken(NetworkNode & source, NetworkNode & destination, Sche
 	sourceCoreIter = lower_bound(tokenPool.begin(), tokenPool.end(), source.block);
 	const bool hasSourceCore = sourceCoreIter != tokenPool.end() && sourceCoreIter->destinationBlockID == source.block;
 
-	//Create the new containers
-	NetworkNode newSource(source.block, hadSource ? vector<NetworkToken>{oldSource} : vector<NetworkToken>());
-	NetworkNode newDest(destination.block, {destinationCore});
+	//Create the new containers, the core tokens aren't used past this point
+	vector<NetworkToken> newSourceTokens, newDestTokens;
+	if(hadSource)
+		newSourceTokens.emplace_back(move(oldSource));
+	newDestTokens.emplace_back(move(destinationCore));
+
+	NetworkNode newSource(source.block, move(newSourceTokens));
+	NetworkNode newDest(destination.block, move(newDestTokens));
 	assert(!newDest.tokens.empty());
 
 	if(hasSourceCore)
@@ -668,8 +751,8 @@ void Network::performToken(NetworkNode & source, NetworkNode & destination, Sche
 	if(newDest.isFinal)		pulledEverythingForNode(destination, destinationSources);
 
 	//Update the network
-	source.tokens = newSource.tokens;			source.refreshOutgoingData();
-	destination.tokens = newDest.tokens;		destination.refreshOutgoingData();
+	source.tokens = move(newSource.tokens);			source.refreshOutgoingData();
+	destination.tokens = move(newDest.tokens);		destination.refreshOutgoingData();
 }
 
 bool netNeedHalfSwap(const NetworkNode & source, const NetworkNode & destination)
@@ -723,6 +806,9 @@ bool Network::performBestSwap(SchedulerData & schedulerData)
 
 	assert(!destination.isFinal);
 
+	queueNode(source);
+	queueNode(destination);
+
 #ifdef PRINT_SELECTED_LINKS
 	cout << "[DEBUG]: Processing token from 0x" << hex << bestToken.sourceBlockID.value << " (pass 0x" << source.touchCount++ <<") to 0x" << bestToken.destinationBlockID.value << " (pass 0x" << destination.touchCount++ <<") with 0x" << bestToken.length << " bytes of data" << dec << endl;
 #endif
@@ -785,8 +871,19 @@ bool Network::performBestSwap(SchedulerData & schedulerData)
 		destination.refreshLargestToken([&](const NetworkToken & token) { return computeLinkWeigth(token); });
 
 		//Refresh largest links if they impacted the links we updated
-		for(auto & node : nodes)
+		//	Only the nodes we just touched and those whose largest link was cleared or goes to source or destination may qualify
+		vector<size_t> candidates(nodesToRequeue);
+		for(const BlockID & block : {source.block, destination.block})
 		{
+			auto targeting = largestTokenDestinations.find(block);
+			if(targeting != largestTokenDestinations.end())
+				candidates.insert(candidates.end(), targeting->second.begin(), targeting->second.end());
+		}
+		candidates.insert(candidates.end(), clearedLargestTokens.begin(), clearedLargestTokens.end());
+
+		for(const size_t nodeID : candidates)
+		{
+			NetworkNode & node = nodes[nodeID];
 			if(!node.isFinal && !node.needRefreshLargestToken && node.block != source.block && node.block != destination.block)
 			{
 				//Mark the node as asking for an update
@@ -794,6 +891,7 @@ bool Network::performBestSwap(SchedulerData & schedulerData)
 				if(token.cleared || token.destinationBlockID == source.block || token.destinationBlockID == destination.block)
 				{
 					node.needRefreshLargestToken = true;
+					queueNode(nodeID);
 				}
 
 #ifdef VERY_AGGRESSIVE_ASSERT
@@ -843,6 +941,7 @@ void Network::sourcesForFinal(const NetworkNode & node, vector<BlockID> & source
 void Network::pulledEverythingForNode(NetworkNode & node, const vector<BlockID> & nodeSources)
 {
 	node.isFinal = true;
+	queueNode(node);
 
 	if(nodeSources.empty())
 		return;
@@ -876,6 +975,8 @@ void Network::pulledEverythingForNode(NetworkNode & node, const vector<BlockID>
 			continue;
 		}
 
+		queueNode(networkNode);
+
 #ifdef VERY_AGGRESSIVE_ASSERT
 		{
 			size_t checkSumOut = 0;
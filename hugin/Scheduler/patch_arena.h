@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2018 Orange
+ *
+ * This software is distributed under the terms and conditions of the 'BSD-3-Clause-Clear'
+ * license which can be found in the file 'LICENSE.txt' in this package distribution
+ * or at 'https://spdx.org/licenses/BSD-3-Clause-Clear.html'.
+ */
+
+/**
+ * @author Emile-Hugo Spir
+ */
+
+#ifndef RAVENS_PATCH_ARENA_H
+#define RAVENS_PATCH_ARENA_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <err.h>
+#include <vector>
+
+//Bump allocator backing the delta and extra buffers of a patch
+//	Buffers are never freed one by one, the arena releases everything at once when the patch is discarded
+class PatchArena
+{
+	std::vector<uint8_t *> chunks;
+	uint8_t * head;
+	size_t spaceLeft;
+
+	static const size_t chunkSize = 64u << 10u;
+
+	uint8_t * newChunk(size_t length)
+	{
+		auto * chunk = (uint8_t *) malloc(length);
+		if(chunk == nullptr)
+			err(1, "Couldn't allocate %zu bytes for the patch", length);
+
+		chunks.push_back(chunk);
+		return chunk;
+	}
+
+public:
+	PatchArena() : head(nullptr), spaceLeft(0) {}
+	PatchArena(const PatchArena &) = delete;
+	PatchArena & operator=(const PatchArena &) = delete;
+	~PatchArena()	{	release();	}
+
+	uint8_t * allocate(size_t length)
+	{
+		if(length > spaceLeft)
+		{
+			//Large buffers get their own chunk, so that we don't waste what is left of the current one
+			if(length > chunkSize / 4)
+				return newChunk(length);
+
+			head = newChunk(chunkSize);
+			spaceLeft = chunkSize;
+		}
+
+		uint8_t * output = head;
+		head += length;
+		spaceLeft -= length;
+		return output;
+	}
+
+	//Take over the buffers of another arena, which is left empty
+	void adopt(PatchArena & other)
+	{
+		chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+		other.chunks.clear();
+		other.head = nullptr;
+		other.spaceLeft = 0;
+	}
+
+	void release()
+	{
+		for(auto chunk : chunks)
+			free(chunk);
+
+		chunks.clear();
+		head = nullptr;
+		spaceLeft = 0;
+	}
+};
+
+#endif //RAVENS_PATCH_ARENA_H
@@ -13,7 +13,9 @@
 #ifndef RAVENS_PUBLIC_COMMAND_H
 #define RAVENS_PUBLIC_COMMAND_H
 
+#include <layout.h>
 #include "config.h"
+#include "patch_arena.h"
 
 enum INSTR
 {
@@ -68,14 +70,16 @@ struct PublicCommand
 
 struct BSDiff
 {
+	//View in the arena of the SchedulerPatch
 	struct DynamicArray
 	{
 		uint8_t * data;
 		size_t length;
-
-		void freeData();
 	};
 
+	//Untouched bytes (a multiple of BLOCK_SIZE) to go over before applying the delta
+	size_t skip;
+
 	DynamicArray delta;
 	DynamicArray extra;
 };
@@ -103,18 +107,19 @@ struct SchedulerPatch
 	std::vector<VerificationRange> oldRanges;
 	std::vector<VerificationRange> newRanges;
 
-	void clear(bool withFree)
-	{
-		if(withFree)
-		{
-			for(auto diff : bsdiff)
-			{
-				diff.delta.freeData();
-				diff.extra.freeData();
-			}
-		}
+	//Backs the delta and extra of the segments, laid out contiguously in stream order
+	PatchArena arena;
 
+	//Geometry of the device the patch was generated for
+	FlashGeometry geometry = FlashGeometry::current();
+
+	//Format of the encoded commands
+	uint16_t format = _manifestFormat;
+
+	void clear()
+	{
 		bsdiff.clear();
+		arena.release();
 		oldRanges.clear();
 		newRanges.clear();
 		startAddress = 0;
@@ -124,8 +129,11 @@ struct SchedulerPatch
 };
 
 
+//Without a geometry, the one of the calling thread is used
 void schedule(const std::vector<BSDiffMoves> & input, std::vector<PublicCommand> & output, bool printStats = false);
+void schedule(const std::vector<BSDiffMoves> & input, std::vector<PublicCommand> & output, const FlashGeometry & geometry, bool printStats = false);
 bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t *newer, size_t newLength, SchedulerPatch &outputPatch, bool printStats);
+bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t *newer, size_t newLength, SchedulerPatch &outputPatch, const FlashGeometry & geometry, bool printStats);
 
 bool runDynamicTestWithFiles(const char * original, const char * newFile);
 bool virtualMachine(const std::vector<PublicCommand> & commands, uint8_t * flash, size_t flashLength);
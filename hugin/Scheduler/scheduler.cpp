@@ -14,11 +14,21 @@
 #include <chrono>
 #include "scheduler.h"
 
-size_t _realBlockSizeBit = BLOCK_SIZE_BIT_DEFAULT;
-size_t _realFullAddressSpace = FLASH_SIZE_BIT_DEFAULT;
+thread_local size_t _realBlockSizeBit = BLOCK_SIZE_BIT_DEFAULT;
+thread_local size_t _realFullAddressSpace = FLASH_SIZE_BIT_DEFAULT;
+size_t _realThreadCount = THREAD_COUNT_DEFAULT;
+PortfolioMode _portfolioMode = PORTFOLIO_DISABLED;
+uint16_t _manifestFormat = MANIFEST_FORMAT_FIXED_WIDTH;
+FlashTimingProfile _flashTimingProfile = {FLASH_ERASE_MS_PER_PAGE_DEFAULT, FLASH_PROGRAM_US_PER_BYTE_DEFAULT, FLASH_READ_US_PER_BYTE_DEFAULT};
 
 void schedule(const vector<BSDiffMoves> & input, vector<PublicCommand> & output, bool printStats)
 {
+	schedule(input, output, FlashGeometry::current(), printStats);
+}
+
+void schedule(const vector<BSDiffMoves> & input, vector<PublicCommand> & output, const FlashGeometry & geometry, bool printStats)
+{
+	FlashGeometryScope geometryScope(geometry);
 	vector<Block> blockStructure;
 
 	if(!buildBlockVector(input, blockStructure))
@@ -48,23 +58,22 @@ size_t trimBSDiff(vector<BSDiffPatch> &patch)
 {
 	size_t lengthTrimmed = 0;
 	BSDiffPatch & lastPatch = patch.back();
+
+	//Untouched pages are never written, there is nothing to trim
+	if(lastPatch.untouched)
+		return 0;
+
 	if(lastPatch.lengthExtra == 0)
 	{
 		size_t trim = lastPatch.lengthDelta;
 		while(trim != 0 && lastPatch.deltaData[--trim] == 0);
 
 		//Extra padding present, we can trim it!
+		//	If the delta is only made of zeros, we keep a single byte so that the last move is the one being extended
 		if(trim != lastPatch.lengthDelta - 1)
 		{
 			lengthTrimmed = lastPatch.lengthDelta - trim - 1;
-			
-			//We may trim, but some data are still left
-			if(trim != 0 || lastPatch.deltaData[0] != 0)
-				lastPatch.lengthDelta = trim + 1;
-
-				//No data left, the last patch is pointless
-			else
-				patch.pop_back();
+			lastPatch.lengthDelta = trim + 1;
 		}
 	}
 	return lengthTrimmed;
@@ -126,7 +135,6 @@ bool stripDeltaBelowThreshold(vector<BSDiffPatch> &patch, size_t & earlySkip, co
 				//Can we remove the full delta section?
 				if(sectionOfDeltaFallingInPrevPage == iter->lengthDelta)
 				{
-					free(iter->deltaData);
 					iter->deltaData = nullptr;
 					iter->lengthDelta = 0;
 					iter->lengthExtra += sectionOfDeltaFallingInPrevPage;
@@ -145,14 +153,10 @@ bool stripDeltaBelowThreshold(vector<BSDiffPatch> &patch, size_t & earlySkip, co
 						(iter - 1)->lengthExtra += sectionOfDeltaFallingInPrevPage;
 					}
 
-					//We need to move the delta data to a smaller buffer
+					//The delta lives in the arena, we only have to skip its beginning
 					iter->oldDataAddress += sectionOfDeltaFallingInPrevPage;
 					iter->lengthDelta -= sectionOfDeltaFallingInPrevPage;
-					memmove(iter->deltaData, &iter->deltaData[sectionOfDeltaFallingInPrevPage], iter->lengthDelta);
-					
-					uint8_t * buffer = (uint8_t *) realloc(iter->deltaData, iter->lengthDelta);
-					assert(buffer);
-					iter->deltaData = buffer;
+					iter->deltaData += sectionOfDeltaFallingInPrevPage;
 				}
 			}
 			
@@ -177,7 +181,6 @@ bool stripDeltaBelowThreshold(vector<BSDiffPatch> &patch, size_t & earlySkip, co
 					iterCopy->extraPos -= iterCopy->lengthDelta;
 					iterCopy->lengthExtra += iterCopy->lengthDelta;
 					
-					free(iterCopy->deltaData);
 					iterCopy->deltaData = nullptr;
 					iterCopy->lengthDelta = 0;
 
@@ -188,10 +191,6 @@ bool stripDeltaBelowThreshold(vector<BSDiffPatch> &patch, size_t & earlySkip, co
 					iterCopy->lengthDelta -= currentPosInBuffer;
 					iterCopy->extraPos -= currentPosInBuffer;
 					iterCopy->lengthExtra += currentPosInBuffer;
-
-					uint8_t * buffer = (uint8_t *) realloc(iterCopy->deltaData, iterCopy->lengthDelta);
-					assert(buffer);
-					iterCopy->deltaData = buffer;
 					break;
 				}
 			}
@@ -206,10 +205,6 @@ bool stripDeltaBelowThreshold(vector<BSDiffPatch> &patch, size_t & earlySkip, co
 				iter->lengthDelta -= sectionOfDeltaFallingInNextPage;
 				iter->extraPos -= sectionOfDeltaFallingInNextPage;
 				iter->lengthExtra += sectionOfDeltaFallingInNextPage;
-				
-				uint8_t * buffer = (uint8_t *) realloc(iter->deltaData, iter->lengthDelta);
-				assert(buffer);
-				iter->deltaData = buffer;
 			}
 
 			amountOfDeltaInPage = 0;
@@ -245,7 +240,21 @@ bool stripDeltaBelowThreshold(vector<BSDiffPatch> &patch, size_t & earlySkip, co
 
 bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t *newer, size_t newLength, SchedulerPatch &outputPatch, bool printStats)
 {
-	outputPatch.clear(false);
+	return generatePatch(original, originalLength, newer, newLength, outputPatch, FlashGeometry::current(), printStats);
+}
+
+bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t *newer, size_t newLength, SchedulerPatch &outputPatch, const FlashGeometry & geometry, bool printStats)
+{
+	if(!geometry.isSupported())
+	{
+		cerr << "This build was made for a fixed flash geometry (pages of " << (1u << BLOCK_SIZE_BIT_DEFAULT) << " bytes, " << FLASH_SIZE_BIT_DEFAULT << " bits of address space)" << endl;
+		return false;
+	}
+
+	FlashGeometryScope geometryScope(geometry);
+
+	outputPatch.clear();
+	outputPatch.geometry = geometry;
 
 	//We look for an identical prefix
 	size_t earlySkip = 0;
@@ -257,15 +266,23 @@ bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t
 	earlySkip &= BLOCK_MASK;
 	outputPatch.startAddress = earlySkip >> BLOCK_SIZE_BIT;
 
+	//Scratch space for the delta of the BSDiffPatch, released once they are copied to outputPatch
 	vector<BSDiffPatch> patch;
+	PatchArena deltaArena;
 
 	//Generate the diff
-	//TODO: Introduce a skip field, to go over vast untouched area faster
 	{
 #ifdef PRINT_SPEED
 		auto beginBSDiff = chrono::high_resolution_clock::now();
 #endif
-		bsdiff(original + earlySkip, originalLength - earlySkip, newer + earlySkip, newLength - earlySkip, patch);
+		//Pages identical in both images are neither diffed nor rewritten, and long shifted runs don't have to be searched
+		vector<MatchedRange> matched;
+		findUntouchedPages(original + earlySkip, originalLength - earlySkip, newer + earlySkip, newLength - earlySkip, matched);
+
+		if(_detectShiftedRuns)
+			findShiftedRuns(original + earlySkip, originalLength - earlySkip, newer + earlySkip, newLength - earlySkip, matched);
+
+		bsdiffWithCache(original, originalLength, earlySkip, newer + earlySkip, newLength - earlySkip, matched, patch, deltaArena);
 #ifdef PRINT_SPEED
 		auto endBSDiff = chrono::high_resolution_clock::now();
 		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endBSDiff - beginBSDiff).count();
@@ -296,12 +313,16 @@ bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t
 
 	if(printStats)
 	{
-		size_t newData = 0;
+		size_t newData = 0, untouchedPages = 0;
 
 		for(auto diff : patch)
+		{
 			newData += diff.lengthExtra;
+			if(diff.untouched)
+				untouchedPages += diff.lengthDelta >> BLOCK_SIZE_BIT;
+		}
 
-		cout << "Valid BSDiff with " << newData << " bytes of new data" << endl;
+		cout << "Valid BSDiff with " << newData << " bytes of new data and " << untouchedPages << " untouched pages" << endl;
 	}
 
 	if(patch.empty())
@@ -314,9 +335,29 @@ bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t
 	vector<BSDiffMoves> moves;
 	moves.reserve(patch.size());
 
-	size_t currentAddress = earlySkip;
+	//The delta and extra of each segment are copied back to back, in stream order, in a single block
+	//	compactBSDiff can then merge segments without copying anything
+	size_t segmentLength = 0;
 	for(const auto & cur : patch)
 	{
+		if(!cur.untouched)
+			segmentLength += cur.lengthDelta + cur.lengthExtra;
+	}
+
+	uint8_t * segmentData = outputPatch.arena.allocate(segmentLength);
+	outputPatch.bsdiff.reserve(patch.size());
+
+	size_t currentAddress = earlySkip, pendingSkip = 0;
+	for(const auto & cur : patch)
+	{
+		//Untouched pages are neither moved nor patched, the next segment will simply go over them
+		if(cur.untouched)
+		{
+			currentAddress += cur.lengthDelta;
+			pendingSkip += cur.lengthDelta;
+			continue;
+		}
+
 		if(cur.lengthDelta != 0)
 		{
 			assert(cur.oldDataAddress + cur.lengthDelta <= originalLength);
@@ -324,19 +365,25 @@ bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t
 		}
 
 		currentAddress += cur.lengthDelta + cur.lengthExtra;
-		
-		uint8_t * extraData = nullptr;
+
+		uint8_t * deltaData = segmentData;
+		if(cur.lengthDelta)
+			memcpy(deltaData, cur.deltaData, cur.lengthDelta);
+
+		uint8_t * extraData = deltaData + cur.lengthDelta;
 		if(cur.lengthExtra)
 		{
-			extraData = (uint8_t *) malloc(cur.lengthExtra);
-			assert(extraData != nullptr);
 			assert(cur.extraPos + cur.lengthExtra <= newLength);
 			memcpy(extraData, &newer[cur.extraPos], cur.lengthExtra);
 		}
 
+		segmentData = extraData + cur.lengthExtra;
+
 		outputPatch.bsdiff.push_back(BSDiff {
+				.skip = pendingSkip,
+
 				.delta = {
-						.data = cur.deltaData,
+						.data = deltaData,
 						.length = cur.lengthDelta
 				},
 
@@ -345,6 +392,8 @@ bool generatePatch(const uint8_t *original, size_t originalLength, const uint8_t
 						.length = cur.lengthExtra
 				}
 		});
+
+		pendingSkip = 0;
 	}
 
 	assert(newLength - currentAddress == lengthTrimmed);
@@ -263,10 +263,27 @@ struct Command
 
 class SchedulerData
 {
+	//A journal only records the operations, so that they can be replayed later in another SchedulerData
+	//	This let independent networks be solved concurrently, while keeping the output in a deterministic order
+	struct JournalEntry
+	{
+		enum
+		{
+			INSERT,
+			NEW_TRANSACTION,
+			FINISH_TRANSACTION
+		} operation;
+
+		Command command;
+	};
+
 	size_t currentTransaction;
 	bool transactionInProgress;
 	vector<Command> commands;
 
+	bool isJournal;
+	vector<JournalEntry> journal;
+
 public:
 
 	bool wantLog;
@@ -275,15 +292,46 @@ public:
 
 	void newTransaction()
 	{
+		if(isJournal)
+		{
+			journal.push_back({JournalEntry::NEW_TRANSACTION, Command(RELEASE_BLOCK)});
+			return;
+		}
+
 		currentTransaction += 1;
 		transactionInProgress = true;
 	}
 
 	void finishTransaction()
 	{
+		if(isJournal)
+		{
+			journal.push_back({JournalEntry::FINISH_TRANSACTION, Command(RELEASE_BLOCK)});
+			return;
+		}
+
 		transactionInProgress = false;
 	}
 
+	void replay(const SchedulerData & journalData)
+	{
+		for(const auto & entry : journalData.journal)
+		{
+			switch(entry.operation)
+			{
+				case JournalEntry::INSERT:
+					insertCommand(entry.command);
+					break;
+				case JournalEntry::NEW_TRANSACTION:
+					newTransaction();
+					break;
+				case JournalEntry::FINISH_TRANSACTION:
+					finishTransaction();
+					break;
+			}
+		}
+	}
+
 	void createChains();
 	void commitUseBlockSection(vector<Command> &newCommands, size_t instructionIgnore, bool &hadBlock, const BlockID &blockChain, vector<Command>::const_iterator &startChain, const vector<Command>::const_iterator &iter) const;
 	void addUseBlocks();
@@ -306,14 +354,10 @@ public:
 	void printStats(const vector<PublicCommand> & publicCommands) const
 	{
 		//Compute the length of the encoded instructions
-		size_t length;
-		{
-			uint8_t * bytes = nullptr;
-			Encoder().encode(publicCommands, bytes, length);
-			free(bytes);
-		}
+		const size_t length = Encoder().measure(publicCommands);
 
 		cout << "Use of " << commands.size() << " commands, using a total of " << length << " bytes." << endl;
+		cout << "Installing the update should take about " << (size_t) estimatedInstallTime(_flashTimingProfile) << " ms." << endl;
 
 		map<BlockID, size_t> blocks;
 
@@ -350,6 +394,20 @@ public:
 			cout << "A total of " << singleErase << " blocks went through a single erase!" << endl;
 	}
 
+	size_t numberOfErases() const
+	{
+		size_t erases = 0;
+		for(const auto & command : commands)
+		{
+			if(command.isEraseLike())
+				erases += 1;
+		}
+
+		return erases;
+	}
+
+	double estimatedInstallTime(const FlashTimingProfile & profile) const;
+
 	void updateLastRebase();
 
 	void normalizeRebase()
@@ -361,14 +419,16 @@ public:
 		}
 	}
 
-	SchedulerData() : currentTransaction(0), transactionInProgress(false), commands(), wantLog(false) {}
+	explicit SchedulerData(bool isJournal = false) : currentTransaction(0), transactionInProgress(false), commands(), isJournal(isJournal), journal(), wantLog(false) {}
 
 };
 
 #include "Token.h"
 #include "Block.h"
 #include "DetailedBlock.h"
+#include "BlockTable.h"
 #include "VirtualMemory.h"
+#include "IndexedHeap.h"
 #include "network.h"
 
 bool buildBlockVector(const vector<BSDiffMoves> & input, vector<Block> & output);
@@ -63,6 +63,12 @@ bool Command::couldConvertToChainCopyWithPrevious(const Command & prev, const Ad
 
 void SchedulerData::insertCommand(Command command)
 {
+	if(isJournal)
+	{
+		journal.push_back({JournalEntry::INSERT, command});
+		return;
+	}
+
 	command.performTrivialOptimization();
 
 	if(command.command == COPY && command.length == 0)
@@ -11,6 +11,10 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <thread>
 #include "scheduler.h"
 
 namespace Scheduler
@@ -36,98 +40,235 @@ namespace Scheduler
 
 	void removeUnidirectionnalReferences(vector<Block> & blocks, SchedulerData & commands)
 	{
-		//We loop in case of a chain (a <- b <- c)
-		//	In this case, C will be scheduled on the first pass and b on the second, as b wasn't free when first evaluated
+		//We schedule the blocks nobody need data from, which may release the blocks they were referring to (a <- b <- c)
+		//	The blocks are processed in rounds matching a scan of the block list repeated until nothing changes:
+		//	a block released by a block placed before it is scheduled in the same round, otherwise in the next one.
+		//	This is the order the original repeated scan used, so the output doesn't change
+
+		typedef priority_queue<size_t, vector<size_t>, greater<size_t>> Round;
+
+		const size_t nbBlocks = blocks.size();
+		vector<size_t> pendingRequests(nbBlocks, 0);
+		Round currentRound, nextRound;
+
+		for(size_t index = 0; index < nbBlocks; ++index)
+		{
+			const Block & block = blocks[index];
+			if(block.blockFinished)
+				continue;
+
+			//Each block requesting data is listed once (crossRefsBlocks), so this is the number of blocks we're waiting for
+			pendingRequests[index] = block.blocksRequestingData.size();
+			if(pendingRequests[index] == 0)
+				currentRound.push(index);
+		}
 
 		commands.insertCommand({REBASE, 0x0, 0});
 
-		bool foundChange;
-		do
+		bool releasedBlocks = false;
+		while(!currentRound.empty())
 		{
-			foundChange = false;
-			for(Block & block : blocks)
+			const size_t currentIndex = currentRound.top();
+			Block & block = blocks[currentIndex];
+			currentRound.pop();
+
+			commands.newTransaction();
+
+			if(block.blockNeedSwap)
+				interpretBlockSort(block, commands, false);
+			else
+				commands.insertCommand({ERASE, block.blockID});
+
+			for(const auto & token : block.data)
 			{
-				if(block.blockFinished)
+				//Token already dealt with by interpretBlockSort
+				if(token.origin == block.blockID)
 					continue;
 
-				//If no incoming references (we pull data from other blocks but nobody need ours, that's an easy case)
-				if(block.blocksRequestingData.empty())
-				{
-					commands.newTransaction();
+				commands.insertCommand({COPY, token.origin, token.length, token.finalAddress});
+			}
+
+			commands.finishTransaction();
+			block.blockFinished = true;
+
+			//We release the blocks we were referring to
+			for(const BlockLink & link : block.blocksWithDataForCurrent)
+			{
+				const size_t index = indexOfBlockID(blocks, link);
+
+				//The block we're copying data from may be outside of the range of the new file, nothing to do
+				if(index >= nbBlocks || blocks[index].blockID != link.block)
+					continue;
 
-					if(block.blockNeedSwap)
-						interpretBlockSort(block, commands, false);
+				releasedBlocks = true;
+				if(--pendingRequests[index] == 0)
+				{
+					if(index > currentIndex)
+						currentRound.push(index);
 					else
-						commands.insertCommand({ERASE, block.blockID});
-
-					for(const auto & token : block.data)
-					{
-						//Token already dealt with by interpretBlockSort
-						if(token.origin == block.blockID)
-							continue;
-
-						commands.insertCommand({COPY, token.origin, token.length, token.finalAddress});
-					}
-
-					commands.finishTransaction();
-					block.blockFinished = true;
-					foundChange = true;
-
-					//We release the blocks we were referring to by remove the reference in their blocksRequestingData
-					for(const BlockLink & blockID : block.blocksWithDataForCurrent)
-					{
-						size_t index = indexOfBlockID(blocks, blockID);
-						if(index < blocks.size())
-						{
-							auto & currentBlockArray = blocks[index].blocksRequestingData;
-
-							//If we had multiple references toward the same block, we may try to delete the record multiple times
-							auto position = find(currentBlockArray.begin(), currentBlockArray.end(), block.blockID);
-							if (position != currentBlockArray.end())
-								currentBlockArray.erase(position);
-						}
-						//`else` The block we're copying data from is outside of the range of the new file, nothing to do
-					}
+						nextRound.push(index);
 				}
 			}
-		} while(foundChange);
+
+			if(currentRound.empty())
+				swap(currentRound, nextRound);
+		}
+
+		//The next passes expect blocksRequestingData to only list the blocks left
+		if(releasedBlocks)
+		{
+			for(Block & block : blocks)
+			{
+				if(block.blockFinished || block.blocksRequestingData.empty())
+					continue;
+
+				auto & requests = block.blocksRequestingData;
+				requests.erase(remove_if(requests.begin(), requests.end(), [&blocks](const BlockLink & link) {
+					return blocks[indexOfBlockID(blocks, link)].blockFinished;
+				}), requests.end());
+			}
+		}
 
 		commands.updateLastRebase();
 	}
 
+	//Heuristics tried by the portfolio mode, the first one being the default
+	static const SwapHeuristic portfolioHeuristics[] = {
+		SwapHeuristic(),
+		SwapHeuristic(2, 3),
+		SwapHeuristic(4, 1),
+		SwapHeuristic(3, 2, 0, 0),
+		SwapHeuristic(3, 2, 5, 3, 1),
+		SwapHeuristic(3, 2, 5, 3, 2),
+	};
+
+	struct PortfolioScore
+	{
+		size_t streamLength;
+		size_t erases;
+		double installTime;
+
+		bool isBetterThan(const PortfolioScore & other) const
+		{
+			if(_portfolioMode == PORTFOLIO_FEWEST_ERASES)
+				return erases < other.erases || (erases == other.erases && streamLength < other.streamLength);
+
+			if(_portfolioMode == PORTFOLIO_FASTEST_INSTALL)
+				return installTime < other.installTime || (installTime == other.installTime && streamLength < other.streamLength);
+
+			return streamLength < other.streamLength || (streamLength == other.streamLength && erases < other.erases);
+		}
+	};
+
+	//Encode the network on its own. The commands around it may slightly change the final encoding, but not which candidate is best
+	static PortfolioScore scoreJournal(const SchedulerData & journal)
+	{
+		SchedulerData data;
+		vector<PublicCommand> output;
+
+		data.insertCommand({REBASE, 0x0, 0});
+		data.replay(journal);
+		data.updateLastRebase();
+		data.generateInstructions(output);
+
+		return {Encoder().measure(output), data.numberOfErases(), data.estimatedInstallTime(_flashTimingProfile)};
+	}
+
 	void removeNetworks(vector<Block> & blocks, SchedulerData & commands)
 	{
+		//Networks don't share any block. We first extract all of them, solve them concurrently (each in its own SchedulerData journal),
+		//	then replay the journals in the order networks were found so that the output doesn't depend on the scheduling
+		vector<vector<size_t>> networks;
 		const size_t length = blocks.size();
-		size_t counter = 0;
 
 		for (size_t i = 0; i < length; ++i)
 		{
 			if (blocks[i].blockFinished)
 				continue;
 
-			commands.insertCommand({REBASE, 0x0, 0});
-
 			vector<size_t> blockNetwork;
 			extractNetwork(blocks, i, blockNetwork);
 
-			if(blockNetwork.empty())
+			for(const size_t index : blockNetwork)
+				blocks[index].blockFinished = true;
+
+			networks.emplace_back(move(blockNetwork));
+		}
+
+		//In portfolio mode, each network is solved once per heuristic. All the candidates go through the same pool of threads
+		const size_t heuristicCount = _portfolioMode == PORTFOLIO_DISABLED ? 1 : sizeof(portfolioHeuristics) / sizeof(portfolioHeuristics[0]);
+		const size_t taskCount = networks.size() * heuristicCount;
+
+		vector<SchedulerData> journals(taskCount, SchedulerData(true));
+		vector<size_t> iterations(taskCount, 0);
+		vector<PortfolioScore> scores(taskCount, {0, 0, 0});
+		atomic<size_t> nextTask(0);
+
+		const FlashGeometry geometry = FlashGeometry::current();
+		auto worker = [&]()
+		{
+			FlashGeometryScope geometryScope(geometry);
+
+			for(size_t current = nextTask++; current < taskCount; current = nextTask++)
 			{
-				continue;
+				const vector<size_t> & blockNetwork = networks[current / heuristicCount];
+				if(blockNetwork.empty())
+					continue;
+
+				Network network(blocks, blockNetwork, portfolioHeuristics[current % heuristicCount]);
+
+				while(network.performBestSwap(journals[current]))
+					iterations[current] += 1;
+
+				network.performFinalFlush(journals[current]);
+
+				if(heuristicCount > 1)
+					scores[current] = scoreJournal(journals[current]);
 			}
+		};
+
+		if(_realThreadCount <= 1 || taskCount <= 1)
+		{
+			worker();
+		}
+		else
+		{
+			vector<thread> threads;
+			for(size_t i = 0; i < min(_realThreadCount, taskCount); ++i)
+				threads.emplace_back(worker);
+
+			for(auto & thread : threads)
+				thread.join();
+		}
 
-			Network network(blocks, blockNetwork);
+		size_t counter = 0, improvedNetworks = 0;
+		for(size_t current = 0; current < networks.size(); ++current)
+		{
+			commands.insertCommand({REBASE, 0x0, 0});
 
-			while(network.performBestSwap(commands))
-				counter += 1;
+			if(networks[current].empty())
+				continue;
 
-			network.performFinalFlush(commands);
+			//Ties go to the earliest heuristic, so that the default is kept unless another one is strictly better
+			size_t best = current * heuristicCount;
+			for(size_t candidate = best + 1; candidate < (current + 1) * heuristicCount; ++candidate)
+			{
+				if(scores[candidate].isBetterThan(scores[best]))
+					best = candidate;
+			}
 
-			for(const size_t index : blockNetwork)
-				blocks[index].blockFinished = true;
+			if(best != current * heuristicCount)
+				improvedNetworks += 1;
 
+			commands.replay(journals[best]);
 			commands.updateLastRebase();
+
+			counter += iterations[best];
 		}
 
+		if(commands.wantLog && heuristicCount > 1)
+			printf("Portfolio improved %zu networks out of %zu\n", improvedNetworks, networks.size());
+
 		if(commands.wantLog && counter > 0)
 			printf("Network solved in %zu iterations\n", counter);
 	}
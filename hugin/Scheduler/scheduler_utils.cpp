@@ -121,13 +121,59 @@ void dumpCommands(const vector<PublicCommand> & commands, const char *string)
 		Command(command).print(output);
 }
 
-void BSDiff::DynamicArray::freeData()
+//Estimate, in ms, how long the device takes to execute the commands, following how Munin decomposes them
+//	Every erase also backs up the cache, which means erasing and programming a second page. Reading or writing the cache is free as it lives in RAM
+double SchedulerData::estimatedInstallTime(const FlashTimingProfile & profile) const
 {
-	if (length)
-		free(data);
+	const double eraseCost = 2 * profile.eraseMsPerPage * 1000 + BLOCK_SIZE * profile.programUsPerByte;
+	double cost = 0;
+	bool chainToCache = false;
 
-	data = nullptr;
-	length = 0;
+	for(const auto & command : commands)
+	{
+		switch(command.command)
+		{
+			case ERASE:
+				cost += eraseCost;
+				break;
+
+			case LOAD_AND_FLUSH:
+				cost += BLOCK_SIZE * profile.readUsPerByte + eraseCost;
+				chainToCache = true;
+				break;
+
+			case FLUSH_AND_PARTIAL_COMMIT:
+				cost += eraseCost + command.length * profile.programUsPerByte;
+				chainToCache = false;
+				break;
+
+			case COMMIT:
+				cost += BLOCK_SIZE * profile.programUsPerByte;
+				chainToCache = false;
+				break;
+
+			case COPY:
+			case CHAINED_COPY:
+			{
+				//Chained copies write after the previous one
+				if(command.command == COPY)
+					chainToCache = command.secondaryBlock == CACHE_BUF;
+
+				if(command.mainBlock != CACHE_BUF)
+					cost += command.length * profile.readUsPerByte;
+
+				if(!chainToCache)
+					cost += command.length * profile.programUsPerByte;
+
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+
+	return cost / 1000;
 }
 
 bool operator>(const BlockID & a, const Block & b) { return b < a;	}
@@ -67,8 +67,10 @@ uint8_t * generateVirtualFlash(size_t & flashLength)
 
 bool validateSchedulerPatch(const uint8_t * original, size_t originalLength, const uint8_t * newer, size_t newLength, const SchedulerPatch & patch)
 {
+	FlashGeometryScope geometryScope(patch.geometry);
+
 	//We make sure the payload is properly encoded and decoded
-	if(Encoder().validate(patch.commands) == 0)
+	if(Encoder(patch.geometry, patch.format).validate(patch.commands) == 0)
 	{
 		cerr << "Couldn't validate the bytecode!" << endl;
 		return false;
@@ -211,6 +213,8 @@ void addReadRange(VerificationRangeCollector & readRange, const VerificationRang
 
 void generateVerificationRangesPrePatch(SchedulerPatch &patch, size_t initialOffset)
 {
+	FlashGeometryScope geometryScope(patch.geometry);
+
 	//We need to collect all reads
 
 	VerificationRangeCollector readRanges, writtenRanges;
@@ -284,6 +288,9 @@ void generateVerificationRangesPrePatch(SchedulerPatch &patch, size_t initialOff
 	size_t readHeadBeforeExtra = initialOffset;
 	for(const auto & bsdiff : patch.bsdiff)
 	{
+		//Untouched pages aren't read by the delta patch
+		initialOffset += bsdiff.skip;
+
 		addReadRange(readRanges, writtenRanges, initialOffset, bsdiff.delta.length);
 
 		initialOffset += bsdiff.delta.length;
@@ -346,10 +353,12 @@ void generateVerificationRangesPrePatch(SchedulerPatch &patch, size_t initialOff
 
 void generateVerificationRangesPostPatch(SchedulerPatch & patch, size_t initialOffset, const size_t fileLength)
 {
+	FlashGeometryScope geometryScope(patch.geometry);
+
 	//Compute the sequential length we're writing to
 	size_t patchLength = 0;
 	for(const auto & bsdiff : patch.bsdiff)
-		patchLength += bsdiff.delta.length + bsdiff.extra.length;
+		patchLength += bsdiff.skip + bsdiff.delta.length + bsdiff.extra.length;
 
 	//We trimmed the end of a block, we want to check it out (we'll cap to the size of the file a bit later)
 	if(patchLength & BLOCK_OFFSET_MASK)
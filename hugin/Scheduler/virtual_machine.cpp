@@ -212,12 +212,17 @@ bool virtualMachine(const vector<PublicCommand> & commands, uint8_t * flash, siz
 
 bool executeBSDiffPatch(const SchedulerPatch & commands, uint8_t * flash, size_t flashLength)
 {
+	FlashGeometryScope geometryScope(commands.geometry);
+
 	if(flash == nullptr || flashLength == 0 || (flashLength & BLOCK_OFFSET_MASK) != 0)
 		return false;
 
 	size_t currentPos = commands.startAddress << BLOCK_SIZE_BIT;
 	for(const auto &patch : commands.bsdiff)
 	{
+		//Go over the untouched pages
+		currentPos += patch.skip;
+
 		//Apply delta
 		for(size_t i = 0; i < patch.delta.length; ++i)
 			flash[currentPos++] += patch.delta.data[i];
@@ -29,6 +29,8 @@ bool processCrypto(int argc, char const *argv[]);
 
 bool performStaticTests();
 bool runDynamicTestWithFiles(const char * original, const char * newFile);
+bool benchmarkSuffixSort(const char * file);
+extern bool _detectShiftedRuns;
 bool testCrypto();
 
 int main(int argc, char *argv[])
@@ -66,6 +68,14 @@ int main(int argc, char *argv[])
 			output &= runDynamicTestWithFiles("test1_v1.bin", "test1_v2.bin");
 			output &= runDynamicTestWithFiles("test2_v1.bin", "test2_v2.bin");
 
+			//Same diff, the shifted runs being detected before bsdiff
+			_detectShiftedRuns = true;
+			output &= runDynamicTestWithFiles("test2_v1.bin", "test2_v2.bin");
+			_detectShiftedRuns = false;
+
+			output &= benchmarkSuffixSort("test1_v1.bin");
+			output &= benchmarkSuffixSort("test2_v1.bin");
+
 			cout << endl << "Validation cryptographic primitives" << endl;
 			output &= testCrypto();
 			return !output;
@@ -295,7 +295,10 @@ RAVENS_CRITICAL bool processInstruction(const DecodedCommand decodedCommand, siz
 	return true;
 }
 
-RAVENS_CRITICAL bool runCommands(const uint8_t * bytes, size_t * currentByteOffset, size_t length, size_t *currentTrace, size_t oldCounter, bool dryRun)
+//State of the range decoder, kept out of the stack as the models take a few hundred bytes
+static EntropyDecoder entropyDecoder;
+
+RAVENS_CRITICAL bool runCommands(const uint8_t * bytes, size_t * currentByteOffset, size_t length, uint16_t format, size_t *currentTrace, size_t oldCounter, bool dryRun)
 {
 	DecoderContext decoderContext = {
 			.usingBlock = false,
@@ -303,19 +306,52 @@ RAVENS_CRITICAL bool runCommands(const uint8_t * bytes, size_t * currentByteOffs
 			.blockIDBits = BLOCK_ID_SPACE,
 			.blockBase = BLOCK_ID_SPACE,
 			.blockIDBitsRef = BLOCK_ID_SPACE,
-			.blockSizeBitsRef = BLOCK_SIZE_BIT
+			.blockSizeBitsRef = BLOCK_SIZE_BIT,
+			.entropy = NULL
 	};
 
+	if(format == MANIFEST_FORMAT_ENTROPY_CODED)
+	{
+		if(!initEntropyDecoder(&entropyDecoder, bytes, length))
+			return false;
+
+		decoderContext.entropy = &entropyDecoder;
+	}
+
+	//The commands start after the checkpoint table
+	if(format == MANIFEST_FORMAT_CHECKPOINTED)
+	{
+		const size_t tableLength = checkpointTableLength(bytes, length);
+		if(tableLength == 0)
+			return false;
+
+		*currentByteOffset = tableLength << 3u;
+	}
+
 	//We first do a dry run to make sure all operations will properly decode.
 	//In this cause, we communicate no writes shall be performed
 	bool needFastForwarding = !dryRun && oldCounter != 0;
 	bool *pNeedFastForwarding = dryRun ? NULL : &needFastForwarding;
 
+	ChainAddress chainAddress;
+	DecodedCommand decodedCommand;
+
 	if(needFastForwarding)
+	{
 		restoreCache(oldCounter);
 
-	ChainAddress chainAddress;
-	DecodedCommand decodedCommand;
+		//Jump to the last checkpoint before the power loss, and only fast forward from there
+		const DecoderCheckpoint * checkpoint = format == MANIFEST_FORMAT_CHECKPOINTED ? findCheckpoint(bytes, oldCounter) : NULL;
+		if(checkpoint != NULL)
+		{
+			restoreCheckpoint(&decoderContext, checkpoint);
+			*currentByteOffset = checkpoint->bitOffset;
+			*currentTrace = checkpoint->traceCounter;
+
+			chainAddress.isCache = checkpoint->chainIsCache;
+			chainAddress.chainAddress = checkpoint->chainAddress;
+		}
+	}
 
 	//Perform the update
 	while(decodeInstruction(&decoderContext, bytes, currentByteOffset, length, &decodedCommand) && decodedCommand.command != OPCODE_END_OF_STREAM)
@@ -21,7 +21,7 @@
 	#include <decoding/decoder.h>
 #endif
 
-bool runCommands(const uint8_t * bytes, size_t * currentByteOffset, size_t length, size_t *currentTrace, size_t oldCounter, bool dryRun);
+bool runCommands(const uint8_t * bytes, size_t * currentByteOffset, size_t length, uint16_t format, size_t *currentTrace, size_t oldCounter, bool dryRun);
 
 void backupCache(size_t counter);
 void restoreCache(size_t counter);
@@ -121,6 +121,20 @@ RAVENS_CRITICAL uint64_t consumeQWord(BSDiffContext * context)
 	return qword.qword;
 }
 
+//A segment starting with an empty delta first goes over a run of untouched pages
+RAVENS_CRITICAL uint32_t consumeDeltaLength(BSDiffContext * context, size_t * currentPage)
+{
+	uint32_t length = consumeDWord(context);
+
+	if(length == 0)
+	{
+		*currentPage += consumeDWord(context) * BLOCK_SIZE;
+		length = consumeDWord(context);
+	}
+
+	return length;
+}
+
 RAVENS_CRITICAL bool performValidation(BSDiffContext * context, bool dryRun)
 {
 	//We at least need a word. This means we ran out of data before, which is bad
@@ -182,19 +196,24 @@ RAVENS_CRITICAL void addByteToOutputBuffer(uint8_t byte, size_t virtualAddress,
  * typedef struct
  *	{
  *		uint32_t flag = BSDIFF_MAGIC;
- *		uint16_t numberSegments;
+ *		uint32_t numberSegments;
  *
  *		struct
  *		{
- *			uint16_t lengthDelta;
+ *			//Optional, only if the segment starts after untouched pages
+ *			uint32_t skipFlag = 0;
+ *			uint32_t numberPagesToSkip;
+ *
+ *			uint32_t lengthDelta;
  *			char delta[lengthDelta];
  *
- *			uint16_t lengthInsert;
+ *			uint32_t lengthInsert;
  *			char extra[lengthInsert];
  *
  *		} bsdiff[];
  *	} BSDiff;
  *
+ * Untouched pages are neither saved, erased nor written.
  */
 
 #include <stdio.h>
@@ -252,7 +271,7 @@ RAVENS_CRITICAL bool applyDeltaPatch(const UpdateHeader * header, size_t current
 	 */
 
 	const uint32_t numberSegments = consumeDWord(&context);
-	uint32_t currentSubsegmentLength = consumeDWord(&context);
+	uint32_t currentSubsegmentLength = consumeDeltaLength(&context, &currentPage);
 
 	while(currentSegment < numberSegments && !context.isOutOfData)
 	{
@@ -390,7 +409,13 @@ RAVENS_CRITICAL bool applyDeltaPatch(const UpdateHeader * header, size_t current
 
 			//We shouldn't read past the end our section
 			if(currentSegment < numberSegments)
-				currentSubsegmentLength = consumeDWord(&context);
+			{
+				//Segments may start by going over untouched pages. The skip always happens at the end of a page
+				if(didDelta)
+					currentSubsegmentLength = consumeDWord(&context);
+				else
+					currentSubsegmentLength = consumeDeltaLength(&context, &currentPage);
+			}
 		}
 
 		//We finished patching our current page
@@ -399,6 +424,7 @@ RAVENS_CRITICAL bool applyDeltaPatch(const UpdateHeader * header, size_t current
 			//Signal the patching is over
 			incrementCounter(&traceCounter, previousCounter, pResuming);
 			haveCachedPage = false;
+			currentPage += BLOCK_SIZE;
 		}
 	}
 
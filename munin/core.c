@@ -210,13 +210,14 @@ RAVENS_CRITICAL void bootloaderPerformUpdate()
 	}
 
 	const uint8_t * baseCommand = &((const uint8_t *) header)[sizeof(UpdateHeader)];
+	const uint16_t format = header->sectionSignedDeviceKey.formatVersion;
 	size_t index = 0, traceCounter = 0;
 	const size_t permanentTraceCounter = getCurrentCounter();
 
 	//We do a dry run to make sure everything is working properly before doing anything destructive
 
 	//We first validate everything will properly decode
-	if(!runCommands(baseCommand, &index, header->sectionSignedDeviceKey.manifestLength, &traceCounter, permanentTraceCounter, true))
+	if(!runCommands(baseCommand, &index, header->sectionSignedDeviceKey.manifestLength, format, &traceCounter, permanentTraceCounter, true))
 	{
 		return concludeUpdate(true);
 	}
@@ -233,7 +234,7 @@ RAVENS_CRITICAL void bootloaderPerformUpdate()
 	//We're not checking the return value after this point because the update has started and it isn't actionnable
 
 	//We first run the commands
-	runCommands(baseCommand, &index, header->sectionSignedDeviceKey.manifestLength, &traceCounter, permanentTraceCounter, false);
+	runCommands(baseCommand, &index, header->sectionSignedDeviceKey.manifestLength, format, &traceCounter, permanentTraceCounter, false);
 
 	//Perform the BSDiff it returns whether the new layout validated the checks appended to the manifest. Not sure what to do of them. Maybe restore the old image if we have one handy?
 	applyDeltaPatch(header, index, traceCounter, permanentTraceCounter, false);